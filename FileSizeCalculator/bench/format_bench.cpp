@@ -0,0 +1,185 @@
+// Rows per second of the report row formatter against the iostream version it replaced
+// (stringstream size_repr, to_string, setw padding) on a synthetic result set.
+// Usage: format_bench [files]
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "tree.h"
+
+using namespace std;
+
+// Discards everything written. With hashing it keeps a hash so both formatters can be checked
+// for identical output, the timed runs only count bytes.
+class HashingBuf : public streambuf {
+    char block[1 << 16];
+    bool hashing;
+public:
+    unsigned long long hash = 1469598103934665603ull;
+    unsigned long long bytes = 0;
+    explicit HashingBuf(bool hashing) : hashing(hashing) { setp(block, block + sizeof(block)); }
+protected:
+    int overflow(int c) override {
+        consume();
+        if(c != traits_type::eof()) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return 0;
+    }
+    int sync() override {
+        consume();
+        return 0;
+    }
+private:
+    void consume() {
+        for(char* c = pbase(); hashing && c < pptr(); c++) {
+            hash = (hash ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+        }
+        bytes += static_cast<unsigned long long>(pptr() - pbase());
+        setp(block, block + sizeof(block));
+    }
+};
+
+static string legacySizeRepr(unsigned long long bytes) {
+    stringstream out;
+    out << fixed << setprecision(4);
+    if(bytes >= GB_BYTES) {
+        if(bytes % GB_BYTES == 0) {
+            out << (bytes / GB_BYTES) << " GB";
+        }else {
+            out << ((double) bytes / GB_BYTES) << " GB";
+        }
+    }else if(bytes >= MB_BYTES) {
+        if(bytes % MB_BYTES == 0) {
+            out << (bytes / MB_BYTES) << " MB";
+        }else {
+            out << ((double) bytes / MB_BYTES) << " MB";
+        }
+    }else if(bytes >= KB_BYTES) {
+        if(bytes % KB_BYTES == 0) {
+            out << (bytes / KB_BYTES) << " KB";
+        }else {
+            out << ((double) bytes / KB_BYTES) << " KB";
+        }
+    }else {
+        out << bytes << " B";
+    }
+    return out.str();
+}
+
+// root -> 64 dirs -> 64 dirs each, files spread over the leaves, sizes log-normal
+static ScanTree syntheticTree(size_t files) {
+    mt19937_64 gen(42);
+    lognormal_distribution<double> sizeDistribution(9.0, 3.0);
+    uniform_int_distribution<int> nameLength(4, 24);
+    uniform_int_distribution<int> letter('a', 'z');
+    auto randomName = [&]() {
+        string name(static_cast<size_t>(nameLength(gen)), 'x');
+        for(char& c : name) c = static_cast<char>(letter(gen));
+        return name + ".dat";
+    };
+
+    ScanTree tree("/data/synthetic");
+    const uint32_t fanOut = 64;
+    vector<uint32_t> leaves;
+    vector<uint32_t> middles;
+    for(uint32_t middle = 0; middle < fanOut; middle++) {
+        vector<uint32_t> children;
+        for(uint32_t leaf = 0; leaf < fanOut; leaf++) {
+            children.push_back(static_cast<uint32_t>(tree.dirCount()));
+            leaves.push_back(children.back());
+            tree.dirParent.push_back(NO_DIR);
+            tree.dirName.push_back(tree.names.intern("leaf" + to_string(leaf)));
+            tree.dirFull.push_back(0);
+            tree.dirPure.push_back(0);
+        }
+        auto id = static_cast<uint32_t>(tree.dirCount());
+        for(uint32_t child : children) tree.dirParent[child] = id;
+        middles.push_back(id);
+        tree.dirParent.push_back(NO_DIR);
+        tree.dirName.push_back(tree.names.intern("group" + to_string(middle)));
+        tree.dirFull.push_back(0);
+        tree.dirPure.push_back(0);
+    }
+    auto root = static_cast<uint32_t>(tree.dirCount());
+    for(uint32_t middle : middles) tree.dirParent[middle] = root;
+    tree.dirParent.push_back(NO_DIR);
+    tree.dirName.push_back(tree.names.intern(tree.root.native()));
+    tree.dirFull.push_back(0);
+    tree.dirPure.push_back(0);
+
+    for(size_t i = 0; i < files; i++) {
+        uint32_t parent = leaves[i % leaves.size()];
+        auto size = static_cast<unsigned long long>(sizeDistribution(gen));
+        tree.fileParent.push_back(parent);
+        tree.fileName.push_back(tree.names.intern(randomName()));
+        tree.fileSize.push_back(size);
+        tree.dirPure[parent] += size;
+        for(uint32_t dir = parent; dir != NO_DIR; dir = tree.dirParent[dir]) tree.dirFull[dir] += size;
+        tree.longestPathName = max(tree.longestPathName, tree.filePath(static_cast<uint32_t>(i)).size());
+    }
+    return tree;
+}
+
+template<typename Body>
+static double seconds(Body body) {
+    auto start = chrono::steady_clock::now();
+    body();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t files = argc > 1 ? stoull(argv[1]) : 2000000;
+    cout << "Generating " << files << " synthetic files..." << endl;
+    ScanTree tree = syntheticTree(files);
+    RowColumns columns{static_cast<int>(tree.fileCount() > 1 ? to_string(tree.fileCount()).size() : 1) + 3,
+                       static_cast<int>(tree.longestPathName + 20)};
+
+    auto writeLegacy = [&](ostream& out) {
+        for(uint32_t file = 0; file < tree.fileCount(); file++) {
+            out << setw(columns.rank) << left << (to_string(file + 1) + ". ");
+            out << setw(columns.path) << left << ("\'" + tree.filePath(file) + "\'");
+            out << setw(20) << left << (legacySizeRepr(tree.fileSize[file]));
+            out << '\n';
+        }
+        out.flush();
+    };
+    auto writeFast = [&](ostream& out) {
+        ReportWriter writer(out);
+        for(uint32_t file = 0; file < tree.fileCount(); file++) {
+            writer.fileRow(tree, columns, file + 1, file);
+        }
+        writer.flush();
+        out.flush();
+    };
+
+    HashingBuf legacyBuf(false), fastBuf(false);
+    ostream legacyOut(&legacyBuf), fastOut(&fastBuf);
+    double legacy = seconds([&] { writeLegacy(legacyOut); });
+    double fast = seconds([&] { writeFast(fastOut); });
+
+    HashingBuf legacyHash(true), fastHash(true);
+    ostream legacyHashOut(&legacyHash), fastHashOut(&fastHash);
+    writeLegacy(legacyHashOut);
+    writeFast(fastHashOut);
+
+    auto rate = [&](double time) { return static_cast<double>(tree.fileCount()) / time; };
+    cout << fixed << setprecision(0);
+    cout << "iostream rows:     " << rate(legacy) << " rows/s (" << setprecision(3) << legacy << " s)" << endl;
+    cout << setprecision(0);
+    cout << "ReportWriter rows: " << rate(fast) << " rows/s (" << setprecision(3) << fast << " s)" << endl;
+    cout << "speedup:           " << setprecision(2) << legacy / fast << "x" << endl;
+    if(legacyHash.hash != fastHash.hash || legacyHash.bytes != fastHash.bytes) {
+        cerr << "Output differs: " << legacyHash.bytes << " vs " << fastHash.bytes << " bytes" << endl;
+        return 1;
+    }
+    cout << "output identical (" << fastHash.bytes << " bytes)" << endl;
+    return 0;
+}
@@ -0,0 +1,346 @@
+// Times the pipeline phases separately on synthetic directory trees written to a temporary
+// directory: the scan with each backend, the three rankings, parsing divisions and bucketing
+// the rankings into them, and the report writer. Trees come from a seeded generator, so the
+// same options give the same tree on every machine. Files are created sparse, only their
+// sizes follow the distribution. Every time is the best of --runs, the scans therefore run
+// with a warm cache. After the timings every shape is checked: an incremental rescan of the
+// unchanged tree must write the same report as the full scan, and every scan (with a FIFO
+// added to the tree) must count the same --groups tables.
+// Usage: scan_bench [--files N] [--fanout N] [--depth N] [--mu X] [--sigma X] [--seed N]
+//                   [--runs N] [-j N] [--dir DIR] [--keep]
+// Without --fanout/--depth it runs a wide, a balanced and a deep shape.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "format.h"
+#include "groups.h"
+#include "rank.h"
+#include "report.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "tree.h"
+
+#ifdef __unix__
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct Shape {
+    string name;
+    size_t fanOut; // subdirectories of every directory above the deepest level
+    size_t depth;  // levels below the root
+    size_t files;  // spread over all directories
+};
+
+struct Options {
+    double sizeMu = 9.0, sizeSigma = 3.0; // log-normal file sizes, the median is e^mu bytes
+    unsigned long long seed = 42;
+    size_t runs = 3;
+    size_t threads = max(1u, thread::hardware_concurrency());
+    fs::path base = fs::temp_directory_path();
+    bool keep = false;
+};
+
+static const unsigned long long MAX_FILE_SIZE = 1ull << 40;
+// Every this many directories one gets an empty subdirectory
+static const size_t EMPTY_DIR_EVERY = 5;
+
+// Writes the shape below root, returns false (after printing why) if it could not
+static bool generateTree(const fs::path& root, const Shape& shape, const Options& options) {
+    mt19937_64 gen(options.seed);
+    lognormal_distribution<double> sizeDistribution(options.sizeMu, options.sizeSigma);
+    error_code ec;
+    fs::remove_all(root, ec);
+    vector<fs::path> dirs{root};
+    vector<fs::path> level{root};
+    for(size_t depth = 0; depth < shape.depth; depth++) {
+        vector<fs::path> next;
+        for(const fs::path& parent : level) {
+            for(size_t i = 0; i < shape.fanOut; i++) next.push_back(parent / ("d" + to_string(i)));
+        }
+        dirs.insert(dirs.end(), next.begin(), next.end());
+        level = move(next);
+    }
+    size_t fileDirs = dirs.size();
+    for(size_t i = 0; i < fileDirs; i += EMPTY_DIR_EVERY) dirs.push_back(dirs[i] / "empty");
+    for(const fs::path& dir : dirs) {
+        if(!fs::create_directories(dir, ec) && ec) {
+            cerr << "Error failed to create " << dir << ": " << ec.message() << endl;
+            return false;
+        }
+    }
+    uniform_int_distribution<size_t> dirDistribution(0, fileDirs - 1);
+    for(size_t i = 0; i < shape.files; i++) {
+        fs::path file = dirs[dirDistribution(gen)] / ("f" + to_string(i) + ".dat");
+        auto size = static_cast<unsigned long long>(min(sizeDistribution(gen), static_cast<double>(MAX_FILE_SIZE)));
+        ofstream(file, ios::binary);
+        fs::resize_file(file, size, ec);
+        if(ec) {
+            cerr << "Error failed to create " << file << ": " << ec.message() << endl;
+            return false;
+        }
+    }
+    // an incremental rescan only trusts directories that were older than the scan it starts from
+    fs::file_time_type dayAgo = fs::file_time_type::clock::now() - chrono::hours(24);
+    for(const fs::path& dir : dirs) fs::last_write_time(dir, dayAgo, ec);
+    return true;
+}
+
+// Writes the unlimited report of tree to path, with its progress kept off the console
+static bool writeFullReport(const ScanTree& tree, const fs::path& path) {
+    vector<uint32_t> fileOrder = rankBySize(tree.fileSize, {}, 1);
+    vector<uint32_t> folderOrder = rankBySize(tree.dirFull, {}, 1);
+    vector<uint32_t> folderPureOrder = rankBySize(tree.dirPure, {}, 1);
+    auto longestPathName = static_cast<int>(min<size_t>(tree.longestPathName + 20, numeric_limits<int>::max()));
+    Report report{tree, tree.dirFull[tree.rootDir()], fileOrder, folderOrder, folderPureOrder, {}, {}, longestPathName};
+    streambuf* console = cout.rdbuf(nullptr);
+    bool written = writeReport(report, path);
+    cout.rdbuf(console);
+    cout.clear();
+    return written;
+}
+
+static string readWhole(const fs::path& path) {
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// A rescan from a snapshot of the unchanged tree takes every directory from the snapshot
+// and must number and order everything like the full scan, so both reports are the same
+// byte for byte (rows of equal size included).
+static bool checkRescan(const fs::path& root, size_t threads, const Options& options) {
+    ScanBackend backend = nativeBackendAvailable() ? ScanBackend::Native : ScanBackend::Portable;
+    fs::path snapshotPath = options.base / "fsc-check.snapshot";
+    fs::path fullPath = options.base / "fsc-check-full.txt", rescanPath = options.base / "fsc-check-rescan.txt";
+    ScanTree full(root);
+    ScanStats fullStats;
+    parallelCalc(full, threads, backend, fullStats);
+    if(!saveSnapshot(full, snapshotPath) || !writeFullReport(full, fullPath)) return false;
+    unique_ptr<ScanTree> previous = loadSnapshot(snapshotPath);
+    if(!previous) return false;
+    ScanTree rescan(root);
+    ScanStats rescanStats;
+    parallelCalc(rescan, threads, backend, rescanStats, previous.get());
+    if(!writeFullReport(rescan, rescanPath)) return false;
+
+    bool reused = rescanStats.reusedDirs == full.dirCount();
+    bool same = readWhole(fullPath) == readWhole(rescanPath);
+    cout << "  " << left << setw(26) << ("check rescan -j " + to_string(threads)) << right
+         << (!reused ? "FAILED, not every directory was reused" : same ? "ok" : "FAILED, the reports differ") << endl;
+    error_code ec;
+    fs::remove(snapshotPath, ec);
+    fs::remove(fullPath, ec);
+    fs::remove(rescanPath, ec);
+    return reused && same;
+}
+
+// Best wall time of `runs` calls of body
+template<typename Body>
+static double bestSeconds(size_t runs, Body body) {
+    double best = 0;
+    for(size_t run = 0; run < runs; run++) {
+        auto start = chrono::steady_clock::now();
+        body();
+        double time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if(run == 0 || time < best) best = time;
+    }
+    return best;
+}
+
+static void printTime(const string& what, double seconds, double items, const char* unit) {
+    cout << "  " << left << setw(26) << what << right << fixed << setprecision(4) << setw(9) << seconds << " s";
+    if(seconds > 0) cout << setprecision(0) << setw(14) << items / seconds << ' ' << unit << "/s";
+    cout << endl;
+}
+
+// The serial scan and both backends must count the same group tables, special files (which
+// the native backend knows from d_type without a stat) included.
+static bool checkGroups(const fs::path& root, const Options& options) {
+    fs::path fifo = root / "check.fifo";
+#ifdef __unix__
+    mkfifo(fifo.c_str(), 0644);
+#endif
+    long long now = unixNanosNow();
+    // threads == 0 is the serial recursiveCalc
+    auto groupReport = [&](size_t threads, ScanBackend backend) {
+        FileGroups groups({GroupKey::Extension, GroupKey::Owner, GroupKey::Age}, now);
+        ScanTree tree(root);
+        ScanStats stats;
+        // a FIFO has no size, both scans report that as an error
+        streambuf* errors = cerr.rdbuf(nullptr);
+        if(threads == 0) {
+            recursiveCalc(tree, stats, nullptr, &groups);
+        }else {
+            parallelCalc(tree, threads, backend, stats, nullptr, nullptr, &groups);
+        }
+        cerr.rdbuf(errors);
+        cerr.clear();
+        fs::path path = options.base / "fsc-check-groups.txt";
+        string report = writeGroupReport(groups, root, {}, path) ? readWhole(path) : string();
+        error_code ec;
+        fs::remove(path, ec);
+        return report;
+    };
+    string serial = groupReport(0, ScanBackend::Portable);
+    bool same = !serial.empty() && groupReport(options.threads, ScanBackend::Portable) == serial;
+    if(nativeBackendAvailable()) same = same && groupReport(options.threads, ScanBackend::Native) == serial;
+    cout << "  " << left << setw(26) << "check groups" << right << (same ? "ok" : "FAILED, the scans count other groups") << endl;
+    error_code ec;
+    fs::remove(fifo, ec);
+    return same;
+}
+
+static bool runShape(const Shape& shape, const Options& options) {
+    fs::path root = options.base / ("fsc-bench-" + shape.name);
+    cout << shape.name << ": fan-out " << shape.fanOut << ", depth " << shape.depth << ", " << shape.files
+         << " files in " << root << endl;
+    if(!generateTree(root, shape, options)) return false;
+
+    ScanTree tree(root);
+    // threads == 0 is the serial recursiveCalc
+    auto timeScan = [&](const string& what, size_t threads, ScanBackend backend) {
+        double time = bestSeconds(options.runs, [&] {
+            tree = ScanTree(root);
+            ScanStats stats;
+            if(threads == 0) {
+                recursiveCalc(tree, stats);
+            }else {
+                parallelCalc(tree, threads, backend, stats);
+            }
+        });
+        printTime(what, time, static_cast<double>(tree.fileCount() + tree.dirCount()), "entries");
+    };
+    timeScan("scan recursive", 0, ScanBackend::Portable);
+    string threads = " -j " + to_string(options.threads);
+    timeScan("scan portable" + threads, options.threads, ScanBackend::Portable);
+    if(nativeBackendAvailable()) timeScan("scan native" + threads, options.threads, ScanBackend::Native);
+
+    vector<uint32_t> fileOrder, folderOrder, folderPureOrder;
+    double sortFiles = bestSeconds(options.runs, [&] { fileOrder = rankBySize(tree.fileSize, {}, options.threads); });
+    printTime("sort files", sortFiles, static_cast<double>(tree.fileCount()), "entries");
+    double sortFolders = bestSeconds(options.runs, [&] {
+        folderOrder = rankBySize(tree.dirFull, {}, options.threads);
+        folderPureOrder = rankBySize(tree.dirPure, {}, options.threads);
+    });
+    printTime("sort folders (full, pure)", sortFolders, 2.0 * static_cast<double>(tree.dirCount()), "entries");
+
+    const string divisionInput = "1000gb,100gb,10gb,1gb,100mb,10mb,1mb,100kb,10kb,1kb,100b";
+    const size_t parses = 10000;
+    vector<unsigned long long> divisions;
+    double parse = bestSeconds(options.runs, [&] {
+        for(size_t i = 0; i < parses; i++) {
+            string input = divisionInput;
+            divisions.clear();
+            parseDivisions(input, divisions);
+        }
+    });
+    printTime("parseDivisions", parse, static_cast<double>(parses), "lists");
+    sort(divisions.begin(), divisions.end(), greater<>());
+
+    // the division ends of each ranking, as the report and the results file find them
+    size_t bucketed = 0;
+    auto bucket = [&](const vector<uint32_t>& order, const vector<unsigned long long>& sizes) {
+        auto current = order.begin();
+        for(unsigned long long division : divisions) {
+            current = partition_point(current, order.end(), [&](uint32_t index) { return sizes[index] >= division; });
+            bucketed += static_cast<size_t>(current - order.begin());
+        }
+    };
+    double bucketing = bestSeconds(options.runs, [&] {
+        bucket(fileOrder, tree.fileSize);
+        bucket(folderOrder, tree.dirFull);
+        bucket(folderPureOrder, tree.dirPure);
+    });
+    printTime("division bucketing", bucketing, 3.0 * static_cast<double>(divisions.size()), "divisions");
+
+    auto longestPathName = static_cast<int>(min<size_t>(tree.longestPathName + 20, numeric_limits<int>::max()));
+    Report report{tree, tree.dirFull[tree.rootDir()], fileOrder, folderOrder, folderPureOrder, divisions, divisions, longestPathName};
+    fs::path reportPath = options.base / ("fsc-bench-" + shape.name + ".txt");
+    streambuf* console = cout.rdbuf(nullptr); // writeReport prints its progress, keep it off the table
+    double write = bestSeconds(options.runs, [&] { writeReport(report, reportPath); });
+    cout.rdbuf(console);
+    cout.clear();
+    printTime("report writer", write, static_cast<double>(tree.fileCount() + 2 * tree.dirCount()), "rows");
+
+    bool checked = checkRescan(root, 1, options);
+    checked = checkRescan(root, options.threads, options) && checked;
+    checked = checkGroups(root, options) && checked;
+
+    if(!options.keep) {
+        error_code ec;
+        fs::remove_all(root, ec);
+        fs::remove(reportPath, ec);
+    }
+    cout << endl;
+    return checked;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    Shape custom{"custom", 0, 0, 50000};
+    bool customShape = false;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        try {
+            if(arg == "--files" && i + 1 < argc) {
+                custom.files = stoull(argv[++i]);
+            }else if(arg == "--fanout" && i + 1 < argc) {
+                custom.fanOut = stoull(argv[++i]);
+                customShape = true;
+            }else if(arg == "--depth" && i + 1 < argc) {
+                custom.depth = stoull(argv[++i]);
+                customShape = true;
+            }else if(arg == "--mu" && i + 1 < argc) {
+                options.sizeMu = stod(argv[++i]);
+            }else if(arg == "--sigma" && i + 1 < argc) {
+                options.sizeSigma = stod(argv[++i]);
+            }else if(arg == "--seed" && i + 1 < argc) {
+                options.seed = stoull(argv[++i]);
+            }else if(arg == "--runs" && i + 1 < argc) {
+                options.runs = max<size_t>(1, stoull(argv[++i]));
+            }else if(arg == "-j" && i + 1 < argc) {
+                options.threads = max<size_t>(1, stoull(argv[++i]));
+            }else if(arg == "--dir" && i + 1 < argc) {
+                options.base = argv[++i];
+            }else if(arg == "--keep") {
+                options.keep = true;
+            }else {
+                cerr << "Usage: " << argv[0] << " [--files N] [--fanout N] [--depth N] [--mu X] [--sigma X] [--seed N]"
+                     << " [--runs N] [-j N] [--dir DIR] [--keep]" << endl;
+                return 5;
+            }
+        }catch(const logic_error& err) {
+            cerr << "Error invalid value for " << arg << ": " << argv[i] << endl;
+            return 5;
+        }
+    }
+
+    vector<Shape> shapes;
+    if(customShape) {
+        if(custom.fanOut == 0 && custom.depth > 0) {
+            cerr << "Error --fanout must be at least 1 below the root" << endl;
+            return 5;
+        }
+        shapes.push_back(custom);
+    }else {
+        shapes = {{"wide", 256, 1, custom.files}, {"balanced", 8, 4, custom.files}, {"deep", 2, 12, custom.files}};
+    }
+    for(const Shape& shape : shapes) {
+        if(!runShape(shape, options)) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,336 @@
+#include "dedupe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <compare>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+#include "format.h"
+#include "output.h"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Bytes hashed at each end of a file before it is read completely, and the read size for that
+static constexpr size_t PROBE_BLOCK = 4096;
+static constexpr size_t READ_BLOCK = 1 << 20;
+
+static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+
+struct Digest {
+    uint64_t low = 0, high = 0;
+    auto operator<=>(const Digest&) const = default;
+};
+
+static uint64_t rotl(uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); }
+static uint64_t mixWord(uint64_t lane, uint64_t word) { return rotl(lane + word * PRIME2, 31) * PRIME1; }
+static uint64_t avalanche(uint64_t x) {
+    x ^= x >> 33;
+    x *= PRIME2;
+    x ^= x >> 29;
+    x *= PRIME3;
+    return x ^ (x >> 32);
+}
+
+// 128 bit content hash over 32 byte stripes in four independent lanes (the xxHash64 round),
+// so the multiplies of a stripe do not wait on each other and compilers vectorize the loop
+// where 64 bit multiplies allow it. Fast, not cryptographic.
+class Hasher {
+    uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+    unsigned char pending[32];
+    size_t pendingSize = 0;
+    unsigned long long length = 0;
+public:
+    void update(const char* data, size_t size) {
+        length += size;
+        if(pendingSize > 0) {
+            size_t take = min(size, sizeof(pending) - pendingSize);
+            memcpy(pending + pendingSize, data, take);
+            pendingSize += take;
+            data += take;
+            size -= take;
+            if(pendingSize < sizeof(pending)) return;
+            stripe(pending);
+            pendingSize = 0;
+        }
+        for(; size >= sizeof(pending); data += sizeof(pending), size -= sizeof(pending)) {
+            stripe(data);
+        }
+        memcpy(pending, data, size);
+        pendingSize = size;
+    }
+
+    Digest finish() {
+        // the tail is zero padded, the length tells padded inputs apart
+        if(pendingSize > 0) {
+            memset(pending + pendingSize, 0, sizeof(pending) - pendingSize);
+            stripe(pending);
+        }
+        uint64_t low = length * PRIME3, high = ~length;
+        for(uint64_t lane : lanes) {
+            low = rotl(low ^ mixWord(0, lane), 27) * PRIME1 + PRIME3;
+            high = (rotl(high + lane * PRIME3, 29) * PRIME2) ^ low;
+        }
+        return {avalanche(low), avalanche(high)};
+    }
+
+private:
+    void stripe(const void* data) {
+        uint64_t words[4];
+        memcpy(words, data, sizeof(words));
+        for(int i = 0; i < 4; i++) {
+            lanes[i] = mixWord(lanes[i], words[i]);
+        }
+    }
+};
+
+// A file opened for hashing, with its identity so hard links count as one copy
+#ifdef __unix__
+class InputFile {
+    int fd;
+public:
+    explicit InputFile(const fs::path& path) : fd(open(path.c_str(), O_RDONLY | O_CLOEXEC)) {}
+    ~InputFile() {
+        if(fd >= 0) close(fd);
+    }
+    bool isOpen() const { return fd >= 0; }
+    bool identify(unsigned long long& size, uint64_t& device, uint64_t& inode) {
+        struct stat st{};
+        if(fstat(fd, &st) != 0) return false;
+        size = static_cast<unsigned long long>(st.st_size);
+        device = static_cast<uint64_t>(st.st_dev);
+        inode = static_cast<uint64_t>(st.st_ino);
+        return true;
+    }
+    bool read(unsigned long long offset, char* data, size_t length) {
+        while(length > 0) {
+            ssize_t got = pread(fd, data, length, static_cast<off_t>(offset));
+            if(got < 0 && errno == EINTR) continue;
+            if(got <= 0) return false;
+            data += got;
+            offset += static_cast<unsigned long long>(got);
+            length -= static_cast<size_t>(got);
+        }
+        return true;
+    }
+};
+#else
+class InputFile {
+    fs::path path;
+    ifstream in;
+public:
+    explicit InputFile(const fs::path& path) : path(path), in(path, ios::binary) {}
+    bool isOpen() const { return in.is_open(); }
+    bool identify(unsigned long long& size, uint64_t& device, uint64_t& inode) {
+        error_code ec;
+        size = fs::file_size(path, ec);
+        device = inode = 0; // unknown, every path is its own copy
+        return !ec;
+    }
+    bool read(unsigned long long offset, char* data, size_t length) {
+        in.seekg(static_cast<streamoff>(offset));
+        in.read(data, static_cast<streamsize>(length));
+        return in.gcount() == static_cast<streamsize>(length);
+    }
+};
+#endif
+
+struct Candidate {
+    uint32_t file;
+    unsigned long long size;
+    Digest digest;
+    uint64_t device = 0, inode = 0;
+    bool readable = true;
+};
+
+// Whether the probe already covers the whole file
+static bool probeIsWhole(unsigned long long size) { return size <= 2 * PROBE_BLOCK; }
+
+// Hashes the first and last block of the candidate's file into its digest. With `rest` the
+// bytes between them are hashed into the digest the probe left (the whole file if it is small).
+static void hashCandidate(const ScanTree& tree, Candidate& candidate, bool rest, vector<char>& buffer,
+                          atomic<unsigned long long>& bytesRead, const MessageSink& messages) {
+    PathString path;
+    tree.appendFilePath(candidate.file, path);
+    InputFile in{fs::path(path)};
+    unsigned long long size;
+    candidate.readable = in.isOpen() && in.identify(size, candidate.device, candidate.inode) && size == candidate.size;
+    Hasher hasher;
+    unsigned long long read = 0;
+    auto hashRange = [&](unsigned long long offset, unsigned long long length) {
+        while(candidate.readable && length > 0) {
+            size_t block = static_cast<size_t>(min<unsigned long long>(length, buffer.size()));
+            candidate.readable = in.read(offset, buffer.data(), block);
+            hasher.update(buffer.data(), block);
+            offset += block;
+            length -= block;
+            read += block;
+        }
+    };
+    if(probeIsWhole(candidate.size)) {
+        hashRange(0, candidate.size);
+    }else if(rest) {
+        hashRange(PROBE_BLOCK, candidate.size - 2 * PROBE_BLOCK);
+    }else {
+        hashRange(0, PROBE_BLOCK);
+        hashRange(candidate.size - PROBE_BLOCK, PROBE_BLOCK);
+    }
+    bytesRead.fetch_add(read, memory_order_relaxed);
+    if(!candidate.readable) {
+        if(messages) {
+            ostringstream message;
+            message << "err dedupe " << fs::path(path) << ": could not be read or changed since the scan";
+            messages(MessageLevel::Error, message.str());
+        }
+        return;
+    }
+    Digest digest = hasher.finish();
+    if(rest) {
+        digest = {avalanche(candidate.digest.low ^ digest.low), avalanche(candidate.digest.high + digest.high)};
+    }
+    candidate.digest = digest;
+}
+
+// Runs work(index, buffer) for every index below count on up to `threads` workers
+template<typename Work>
+static void forEachParallel(size_t count, size_t threads, Work work) {
+    atomic<size_t> next{0};
+    auto worker = [&] {
+        vector<char> buffer(READ_BLOCK);
+        for(size_t i; (i = next.fetch_add(1, memory_order_relaxed)) < count;) {
+            work(i, buffer);
+        }
+    };
+    threads = min(threads, count);
+    if(threads <= 1) {
+        worker();
+        return;
+    }
+    vector<thread> workers;
+    for(size_t i = 0; i < threads; i++) workers.emplace_back(worker);
+    for(thread& thread : workers) thread.join();
+}
+
+// Drops unreadable candidates and those whose size and digest no other candidate shares,
+// the rest ends up sorted by size and digest
+static void keepColliding(vector<Candidate>& candidates, DedupeStats& stats) {
+    erase_if(candidates, [&stats](const Candidate& candidate) {
+        if(!candidate.readable) stats.unreadable++;
+        return !candidate.readable;
+    });
+    sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if(a.size != b.size) return a.size < b.size;
+        if(a.digest != b.digest) return a.digest < b.digest;
+        return a.file < b.file;
+    });
+    size_t kept = 0;
+    for(size_t start = 0, end; start < candidates.size(); start = end) {
+        for(end = start + 1; end < candidates.size() && candidates[end].size == candidates[start].size &&
+                             candidates[end].digest == candidates[start].digest; end++) {}
+        if(end - start < 2) continue;
+        for(size_t i = start; i < end; i++) candidates[kept++] = candidates[i];
+    }
+    candidates.resize(kept);
+}
+
+vector<DuplicateGroup> findDuplicates(const ScanTree& tree, size_t threads, DedupeStats& stats) {
+    vector<uint32_t> bySize(tree.fileCount());
+    iota(bySize.begin(), bySize.end(), 0u);
+    sort(bySize.begin(), bySize.end(), [&tree](uint32_t a, uint32_t b) {
+        return tree.fileSize[a] != tree.fileSize[b] ? tree.fileSize[a] < tree.fileSize[b] : a < b;
+    });
+    vector<Candidate> candidates;
+    for(size_t start = 0, end; start < bySize.size(); start = end) {
+        unsigned long long size = tree.fileSize[bySize[start]];
+        for(end = start + 1; end < bySize.size() && tree.fileSize[bySize[end]] == size; end++) {}
+        if(end - start < 2 || size == 0) continue;
+        for(size_t i = start; i < end; i++) candidates.push_back({bySize[i], size, {}});
+        stats.candidateBytes += size * (end - start);
+    }
+    stats.candidates = candidates.size();
+
+    atomic<unsigned long long> bytesRead{0};
+    stats.probed = candidates.size();
+    forEachParallel(candidates.size(), threads, [&](size_t i, vector<char>& buffer) {
+        hashCandidate(tree, candidates[i], false, buffer, bytesRead, stats.messages);
+    });
+    keepColliding(candidates, stats);
+
+    vector<size_t> partial;
+    for(size_t i = 0; i < candidates.size(); i++) {
+        if(!probeIsWhole(candidates[i].size)) partial.push_back(i);
+    }
+    stats.fullyHashed = partial.size();
+    forEachParallel(partial.size(), threads, [&](size_t i, vector<char>& buffer) {
+        hashCandidate(tree, candidates[partial[i]], true, buffer, bytesRead, stats.messages);
+    });
+    keepColliding(candidates, stats);
+    stats.bytesRead = bytesRead;
+
+    vector<DuplicateGroup> groups;
+    for(size_t start = 0, end; start < candidates.size(); start = end) {
+        for(end = start + 1; end < candidates.size() && candidates[end].size == candidates[start].size &&
+                             candidates[end].digest == candidates[start].digest; end++) {}
+        DuplicateGroup group{candidates[start].size, 0, {}};
+        vector<pair<uint64_t, uint64_t>> copies;
+        for(size_t i = start; i < end; i++) {
+            group.files.push_back(candidates[i].file);
+            if(candidates[i].inode == 0) {
+                copies.emplace_back(0, group.files.size()); // identity unknown, a copy of its own
+            }else {
+                copies.emplace_back(candidates[i].device, candidates[i].inode);
+            }
+        }
+        sort(copies.begin(), copies.end());
+        auto distinct = static_cast<unsigned long long>(unique(copies.begin(), copies.end()) - copies.begin());
+        group.reclaimable = group.size * (distinct - 1);
+        if(group.reclaimable > 0) groups.push_back(move(group));
+    }
+    sort(groups.begin(), groups.end(), [](const DuplicateGroup& a, const DuplicateGroup& b) {
+        return a.reclaimable != b.reclaimable ? a.reclaimable > b.reclaimable : a.files[0] < b.files[0];
+    });
+    return groups;
+}
+
+bool writeDuplicateReport(const ScanTree& tree, const vector<DuplicateGroup>& groups, const DedupeStats& stats,
+                          const fs::path& output) {
+    return writeFileAtomically(output, [&](ostream& stream) {
+        ReportWriter out(stream);
+        unsigned long long reclaimable = 0;
+        for(const DuplicateGroup& group : groups) reclaimable += group.reclaimable;
+        ostringstream root;
+        root << fs::absolute(tree.root);
+        out << "Duplicates in " << root.str() << ": " << static_cast<unsigned long long>(groups.size()) << " groups, ";
+        out.size(reclaimable) << " reclaimable\n";
+        out << "Read ";
+        out.size(stats.bytesRead) << " of ";
+        out.size(stats.candidateBytes) << " in " << static_cast<unsigned long long>(stats.candidates) << " candidates ("
+            << static_cast<unsigned long long>(stats.probed) << " probed, "
+            << static_cast<unsigned long long>(stats.fullyHashed) << " fully hashed, "
+            << static_cast<unsigned long long>(stats.unreadable) << " unreadable)\n";
+        for(size_t i = 0; i < groups.size(); i++) {
+            const DuplicateGroup& group = groups[i];
+            out << '\n' << static_cast<unsigned long long>(i + 1) << ". "
+                << static_cast<unsigned long long>(group.files.size()) << " x ";
+            out.size(group.size) << ", ";
+            out.size(group.reclaimable) << " reclaimable";
+            out.endLine();
+            for(uint32_t file : group.files) {
+                out << "   '" << tree.filePath(file) << '\'';
+                out.endLine();
+            }
+        }
+    });
+}
@@ -0,0 +1,39 @@
+#ifndef FILESIZECALCULATOR_DEDUPE_H
+#define FILESIZECALCULATOR_DEDUPE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "messages.h"
+#include "tree.h"
+
+// Files of one size with identical contents
+struct DuplicateGroup {
+    unsigned long long size;
+    unsigned long long reclaimable; // size times the copies beyond the first (hard links are one copy)
+    std::vector<uint32_t> files;
+};
+
+struct DedupeStats {
+    size_t candidates = 0;   // files sharing their size with another file
+    size_t probed = 0;       // of those, files whose first and last block were hashed
+    size_t fullyHashed = 0;  // files read completely
+    size_t unreadable = 0;   // dropped because they could not be read or changed size
+    unsigned long long candidateBytes = 0;
+    unsigned long long bytesRead = 0;
+    MessageSink messages; // told about every unreadable file, from the hashing threads
+};
+
+// Finds files with identical contents in stages that each only look at what is left of the
+// previous one: files are grouped by size (unique sizes and empty files are dropped), the
+// first and last block of every remaining file is hashed, and only files that still share
+// size and hash are read completely. Hashing runs on `threads` workers. Groups are sorted by
+// reclaimable bytes, biggest first.
+std::vector<DuplicateGroup> findDuplicates(const ScanTree& tree, size_t threads, DedupeStats& stats);
+
+// Returns false (after printing why) if it could not be written
+bool writeDuplicateReport(const ScanTree& tree, const std::vector<DuplicateGroup>& groups, const DedupeStats& stats,
+                          const std::filesystem::path& output);
+
+#endif //FILESIZECALCULATOR_DEDUPE_H
@@ -0,0 +1,288 @@
+#include "diff.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "output.h"
+#include "results.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// One folder in either scan, NO_DIR on the side it is missing from
+struct DiffRow {
+    uint32_t oldDir, newDir;
+    unsigned long long oldFull, newFull, oldPure, newPure;
+
+    long long fullGrowth() const { return static_cast<long long>(newFull) - static_cast<long long>(oldFull); }
+    long long pureGrowth() const { return static_cast<long long>(newPure) - static_cast<long long>(oldPure); }
+};
+
+// Keeps the `limit` rows with the biggest key, equal keys in the order they were offered
+template<typename Key>
+class TopRows {
+public:
+    struct Entry {
+        Key key;
+        unsigned long long order;
+        DiffRow row;
+    };
+
+    explicit TopRows(size_t limit) : limit(limit) {}
+
+    void offer(Key key, unsigned long long order, const DiffRow& row) {
+        if(limit == 0) return;
+        Entry entry{key, order, row};
+        if(heap.size() < limit) {
+            heap.push_back(entry);
+            push_heap(heap.begin(), heap.end(), better);
+        }else if(better(entry, heap.front())) {
+            // the front is the worst row kept
+            pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = entry;
+            push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    // Best first, the rows are gone afterwards
+    vector<Entry> take() {
+        sort_heap(heap.begin(), heap.end(), better);
+        return move(heap);
+    }
+
+private:
+    size_t limit;
+    vector<Entry> heap;
+
+    static bool better(const Entry& a, const Entry& b) { return a.key != b.key ? a.key > b.key : a.order < b.order; }
+};
+
+static span<const uint32_t> childDirs(const ResultFile& results, uint32_t dir) {
+    auto start = results.section<uint64_t>(DirChildStart);
+    auto children = results.section<uint32_t>(DirChildren);
+    if(dir == NO_DIR || dir + 1 >= start.size() || start[dir] > start[dir + 1] || start[dir + 1] > children.size()) return {};
+    return children.subspan(start[dir], start[dir + 1] - start[dir]);
+}
+
+// Visits every folder of both scans once, parents before their subfolders
+template<typename Visit>
+static void walkBoth(const ResultFile& before, const ResultFile& after, Visit visit) {
+    auto beforeFull = before.section<uint64_t>(DirFull), beforePure = before.section<uint64_t>(DirPure);
+    auto afterFull = after.section<uint64_t>(DirFull), afterPure = after.section<uint64_t>(DirPure);
+    auto beforeNames = before.section<uint32_t>(DirName), afterNames = after.section<uint32_t>(DirName);
+    vector<pair<uint32_t, uint32_t>> pending{{before.rootDir(), after.rootDir()}};
+    while(!pending.empty()) {
+        auto [oldDir, newDir] = pending.back();
+        pending.pop_back();
+        DiffRow row{oldDir, newDir, 0, 0, 0, 0};
+        if(oldDir < before.dirCount()) {
+            row.oldFull = beforeFull[oldDir];
+            row.oldPure = beforePure[oldDir];
+        }
+        if(newDir < after.dirCount()) {
+            row.newFull = afterFull[newDir];
+            row.newPure = afterPure[newDir];
+        }
+        visit(row);
+
+        // both child lists are sorted by name, so matching them is a merge
+        span<const uint32_t> oldChildren = childDirs(before, oldDir), newChildren = childDirs(after, newDir);
+        size_t i = 0, j = 0;
+        while(i < oldChildren.size() || j < newChildren.size()) {
+            if(j == newChildren.size()) {
+                pending.emplace_back(oldChildren[i++], NO_DIR);
+            }else if(i == oldChildren.size()) {
+                pending.emplace_back(NO_DIR, newChildren[j++]);
+            }else {
+                PathView oldName = before.name(beforeNames[oldChildren[i]]);
+                PathView newName = after.name(afterNames[newChildren[j]]);
+                if(oldName < newName) {
+                    pending.emplace_back(oldChildren[i++], NO_DIR);
+                }else if(newName < oldName) {
+                    pending.emplace_back(NO_DIR, newChildren[j++]);
+                }else {
+                    pending.emplace_back(oldChildren[i++], newChildren[j++]);
+                }
+            }
+        }
+    }
+}
+
+static void writeGrowth(ReportWriter& out, long long growth) {
+    out << (growth < 0 ? '-' : '+');
+    out.size(growth < 0 ? 0ull - static_cast<unsigned long long>(growth) : static_cast<unsigned long long>(growth));
+}
+
+static string rowPath(const ResultFile& before, const ResultFile& after, const DiffRow& row) {
+    return row.newDir != NO_DIR ? after.dirPath(row.newDir) : before.dirPath(row.oldDir);
+}
+
+static void writeSizes(ReportWriter& out, unsigned long long from, unsigned long long to, const DiffRow& row) {
+    out.size(from) << " -> ";
+    out.size(to);
+    if(row.oldDir == NO_DIR) out << ", new";
+    if(row.newDir == NO_DIR) out << ", removed";
+}
+
+// Ranked rows of an absolute growth ranking with the report's division markers
+static void writeAbsoluteSection(ReportWriter& out, const ResultFile& before, const ResultFile& after, string_view title,
+                                 vector<TopRows<long long>::Entry> rows, bool pure,
+                                 const vector<unsigned long long>& divisions) {
+    out << "\n==== " << title << " ====";
+    out.endLine();
+    size_t current = 0;
+    auto writeRow = [&](size_t rank) {
+        const DiffRow& row = rows[rank].row;
+        out << static_cast<unsigned long long>(rank + 1) << ". '" << rowPath(before, after, row) << "' ";
+        writeGrowth(out, rows[rank].key);
+        out << " (";
+        if(pure) {
+            writeSizes(out, row.oldPure, row.newPure, row);
+        }else {
+            writeSizes(out, row.oldFull, row.newFull, row);
+        }
+        out << ')';
+        out.endLine();
+    };
+    for(unsigned long long division : divisions) {
+        out << "Marker Start ";
+        out.size(division).endLine();
+        for(; current < rows.size() && rows[current].key >= static_cast<long long>(division); current++) {
+            writeRow(current);
+        }
+        out << "Marker End ";
+        out.size(division).endLine();
+    }
+    for(; current < rows.size(); current++) {
+        writeRow(current);
+    }
+}
+
+static bool parseSizes(string text, vector<unsigned long long>& sizes) {
+    try {
+        parseDivisions(text, sizes);
+    }catch(const logic_error& err) {
+        cerr << "Error invalid size: " << err.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+int runDiff(int argc, char* argv[]) {
+    if(argc < 3) {
+        cerr << "Usage: diff OLD NEW [--top N] [--divisions SIZES] [--min-size SIZE] [--output FILE]" << endl;
+        return 5;
+    }
+    size_t top = 50;
+    vector<unsigned long long> divisions;
+    unsigned long long minSize = 0;
+    fs::path outputPath;
+    for(int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--top" && i + 1 < argc) {
+            try {
+                top = stoull(argv[++i]);
+            }catch(const logic_error& err) {
+                cerr << "Error invalid --top count: " << argv[i] << endl;
+                return 5;
+            }
+        }else if(arg == "--divisions" && i + 1 < argc) {
+            if(!parseSizes(argv[++i], divisions)) return 3;
+        }else if(arg == "--min-size" && i + 1 < argc) {
+            vector<unsigned long long> parsed;
+            if(!parseSizes(argv[++i], parsed)) return 5;
+            if(parsed.size() != 1) {
+                cerr << "Error expected a single size: " << argv[i] << endl;
+                return 5;
+            }
+            minSize = parsed[0];
+        }else if(arg == "--output" && i + 1 < argc) {
+            outputPath = argv[++i];
+        }else {
+            cerr << "Error unknown argument: " << arg << endl;
+            return 5;
+        }
+    }
+    sort(divisions.begin(), divisions.end(), greater<>());
+    // growth is signed, bigger divisions could not hold anything
+    erase_if(divisions, [](unsigned long long division) { return division > static_cast<unsigned long long>(numeric_limits<long long>::max()); });
+
+    ResultFile before, after;
+    if(!before.open(argv[1]) || !after.open(argv[2])) {
+        return 9;
+    }
+    if(before.dirPath(before.rootDir()) != after.dirPath(after.rootDir())) {
+        cerr << "Warning: the scans are of " << before.dirPath(before.rootDir()) << " and "
+             << after.dirPath(after.rootDir()) << ", comparing them anyway" << endl;
+    }
+
+    TopRows<long long> fullGrowth(top), pureGrowth(top);
+    TopRows<double> relativeGrowth(top);
+    unsigned long long order = 0, both = 0, added = 0, removed = 0;
+    vector<unsigned long long> fullInDivision(divisions.size()), pureInDivision(divisions.size());
+    walkBoth(before, after, [&](const DiffRow& row) {
+        order++;
+        if(row.oldDir == NO_DIR) {
+            added++;
+        }else if(row.newDir == NO_DIR) {
+            removed++;
+        }else {
+            both++;
+        }
+        long long full = row.fullGrowth(), pure = row.pureGrowth();
+        for(size_t i = 0; i < divisions.size(); i++) {
+            if(full >= static_cast<long long>(divisions[i])) fullInDivision[i]++;
+            if(pure >= static_cast<long long>(divisions[i])) pureInDivision[i]++;
+        }
+        fullGrowth.offer(full, order, row);
+        pureGrowth.offer(pure, order, row);
+        if(row.oldDir != NO_DIR && row.newDir != NO_DIR && row.oldFull > 0 && row.oldFull >= minSize) {
+            relativeGrowth.offer(static_cast<double>(full) / static_cast<double>(row.oldFull), order, row);
+        }
+    });
+
+    auto writeDiff = [&](ostream& stream) {
+        ReportWriter out(stream);
+        out << "Growth of '" << after.dirPath(after.rootDir()) << "': ";
+        writeSizes(out, before.totalSize(), after.totalSize(), {0, 0, 0, 0, 0, 0});
+        out << " (";
+        writeGrowth(out, static_cast<long long>(after.totalSize()) - static_cast<long long>(before.totalSize()));
+        out << ")\nFolders: " << both << " in both scans, " << added << " new, " << removed << " removed\n";
+        for(size_t i = 0; i < divisions.size(); i++) {
+            out << "Grown >= ";
+            out.size(divisions[i]) << ": " << fullInDivision[i] << " full, " << pureInDivision[i] << " pure | ";
+        }
+        if(!divisions.empty()) out.endLine();
+
+        writeAbsoluteSection(out, before, after, "FOLDERS FULL GROWTH", fullGrowth.take(), false, divisions);
+        writeAbsoluteSection(out, before, after, "FOLDERS PURE GROWTH", pureGrowth.take(), true, divisions);
+
+        out << "\n==== FOLDERS FULL RELATIVE GROWTH ====";
+        out.endLine();
+        vector<TopRows<double>::Entry> relative = relativeGrowth.take();
+        for(size_t rank = 0; rank < relative.size(); rank++) {
+            const DiffRow& row = relative[rank].row;
+            char percent[32];
+            snprintf(percent, sizeof(percent), "%+.2f%%", relative[rank].key * 100);
+            out << static_cast<unsigned long long>(rank + 1) << ". '" << rowPath(before, after, row) << "' " << percent << " (";
+            writeGrowth(out, row.fullGrowth());
+            out << ", ";
+            writeSizes(out, row.oldFull, row.newFull, row);
+            out << ')';
+            out.endLine();
+        }
+    };
+    if(outputPath.empty()) {
+        writeDiff(cout);
+        cout << flush;
+        return cout ? 0 : 6;
+    }
+    return writeFileAtomically(outputPath, writeDiff) ? 0 : 6;
+}
@@ -0,0 +1,14 @@
+#ifndef FILESIZECALCULATOR_DIFF_H
+#define FILESIZECALCULATOR_DIFF_H
+
+// `FileSizeCalculator diff OLD NEW [--top N] [--divisions SIZES] [--min-size SIZE] [--output FILE]`
+// compares two results files (see results.h) of the same root. Both trees are walked together,
+// matching each folder's subfolders by name from the name sorted child lists, so it takes one
+// pass over the mapped files and memory for the N rows kept per ranking only. Rankings:
+//   folders full / pure by absolute growth, with division markers at the growth SIZES
+//   folders full by relative growth, of folders that were at least --min-size big before
+// Folders only in NEW grew from 0, folders only in OLD are counted as removed.
+// argv[0] is "diff". Returns the process exit code.
+int runDiff(int argc, char* argv[]);
+
+#endif //FILESIZECALCULATOR_DIFF_H
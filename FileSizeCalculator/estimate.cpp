@@ -0,0 +1,268 @@
+#include "estimate.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "output.h"
+#include "report.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Half width of a 95% confidence interval in standard errors
+static constexpr double Z_95 = 1.96;
+// A descent stops this deep even if there are subdirectories left (symlink loops)
+static constexpr size_t MAX_DESCENT = 4096;
+
+static void count(atomic<unsigned long long>& counter, unsigned long long amount = 1) {
+    counter.fetch_add(amount, memory_order_relaxed);
+}
+
+// Sizes of the files in a directory and the names of its subdirectories, the filter applied
+struct Listing {
+    unsigned long long fileBytes = 0;
+    vector<PathString> subdirs;
+};
+
+static shared_ptr<const Listing> listDir(const fs::path& path, const ScanFilter* filter, ScanStats& stats) {
+    auto listing = make_shared<Listing>();
+    count(stats.dirOpens);
+    error_code ec;
+    fs::directory_iterator it(path, ec);
+    if(ec) {
+        countError(stats, "directory_iterator", path, ec.message());
+        return listing;
+    }
+    for(; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        error_code typeError;
+        bool isDirectory = entry.is_directory(typeError);
+        PathString name = entry.path().filename().native();
+        if(filter && filter->skips(path.native(), name, isDirectory)) {
+            count(stats.skipped);
+            continue;
+        }
+        if(isDirectory) {
+            if(filter && filter->sameFileSystem()) {
+                count(stats.stats);
+                if(filter->otherDevice(entry.path())) {
+                    count(stats.skipped);
+                    continue;
+                }
+            }
+            listing->subdirs.push_back(name);
+            continue;
+        }
+        count(stats.stats);
+        error_code sizeError;
+        uintmax_t size = entry.file_size(sizeError);
+        if(sizeError) {
+            countError(stats, "file_size", entry.path(), sizeError.message());
+        }else {
+            listing->fileBytes += static_cast<unsigned long long>(size);
+        }
+        count(stats.files);
+    }
+    count(stats.dirs);
+    return listing;
+}
+
+// Listings shared by every worker, in shards so that lookups rarely wait for each other.
+// Full shards stop taking listings, descents then list those directories again.
+class ListingCache {
+    static constexpr size_t SHARDS = 64;
+    static constexpr size_t SHARD_CAPACITY = 1 << 15;
+    struct Shard {
+        mutex lock;
+        unordered_map<PathString, shared_ptr<const Listing>> listings;
+    };
+    array<Shard, SHARDS> shards;
+    const ScanFilter* filter;
+    ScanStats& stats;
+
+public:
+    ListingCache(const ScanFilter* filter, ScanStats& stats) : filter(filter), stats(stats) {}
+
+    shared_ptr<const Listing> get(const fs::path& path) {
+        Shard& shard = shards[hash<PathString>{}(path.native()) % SHARDS];
+        {
+            lock_guard<mutex> guard(shard.lock);
+            auto found = shard.listings.find(path.native());
+            if(found != shard.listings.end()) return found->second;
+        }
+        // listed outside the lock, two workers may list the same directory once
+        shared_ptr<const Listing> listing = listDir(path, filter, stats);
+        lock_guard<mutex> guard(shard.lock);
+        if(shard.listings.size() < SHARD_CAPACITY) shard.listings.emplace(path.native(), listing);
+        return listing;
+    }
+};
+
+// Running mean and sum of squared deviations of one folder's descents (Welford)
+struct Samples {
+    unsigned long long count = 0;
+    double mean = 0, m2 = 0;
+
+    void add(double value) {
+        count++;
+        double delta = value - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (value - mean);
+    }
+    // Chan's pairwise update
+    void merge(const Samples& other) {
+        if(other.count == 0) return;
+        double total = static_cast<double>(count + other.count);
+        double delta = other.mean - mean;
+        mean += delta * static_cast<double>(other.count) / total;
+        m2 += other.m2 + delta * delta * static_cast<double>(count) * static_cast<double>(other.count) / total;
+        count += other.count;
+    }
+};
+
+// One descent from start, returns the estimated full size. `chain` is cleared when some
+// directory on the way had more than one subdirectory, a subtree without one is a single
+// path and the estimate is its exact size.
+static double descend(const fs::path& start, ListingCache& cache, mt19937_64& random, bool& chain) {
+    double weight = 1, estimate = 0;
+    fs::path current = start;
+    for(size_t level = 0; level < MAX_DESCENT; level++) {
+        shared_ptr<const Listing> listing = cache.get(current);
+        estimate += weight * static_cast<double>(listing->fileBytes);
+        size_t subdirs = listing->subdirs.size();
+        if(subdirs == 0) break;
+        if(subdirs > 1) chain = false;
+        weight *= static_cast<double>(subdirs);
+        current /= listing->subdirs[uniform_int_distribution<size_t>(0, subdirs - 1)(random)];
+    }
+    return estimate;
+}
+
+vector<EstimatedDir> estimateTree(const fs::path& root, const EstimateOptions& options, ScanStats& stats) {
+    auto deadline = chrono::steady_clock::now() + options.budget;
+    ListingCache cache(options.filter, stats);
+
+    // the first levels, breadth first: parents come before their subdirectories
+    vector<EstimatedDir> dirs{{root, NO_DIR, 0, 0, 0}};
+    vector<size_t> frontier; // folders on the last listed level
+    vector<double> variance{0};
+    {
+        vector<size_t> level{0};
+        for(size_t depth = 0; depth < options.depth && !level.empty(); depth++) {
+            vector<size_t> next;
+            for(size_t dir : level) {
+                shared_ptr<const Listing> listing = cache.get(dirs[dir].path);
+                dirs[dir].estimate = listing->fileBytes;
+                for(const PathString& name : listing->subdirs) {
+                    next.push_back(dirs.size());
+                    dirs.push_back({dirs[dir].path / name, static_cast<uint32_t>(dir), 0, 0, 0});
+                    variance.push_back(0);
+                }
+            }
+            level.swap(next);
+        }
+        frontier = level;
+    }
+
+    // Tickets hand out the frontier round-robin. The first two rounds always run, after that
+    // workers stop at the deadline. Chains are exact after one descent and are left out.
+    size_t frontierCount = frontier.size();
+    vector<vector<Samples>> samples(max<size_t>(options.threads, 1), vector<Samples>(frontierCount));
+    vector<atomic<bool>> exact(frontierCount);
+    atomic<size_t> exactCount{0};
+    atomic<unsigned long long> nextTicket{0};
+    auto run = [&](size_t self) {
+        mt19937_64 random(random_device{}() ^ (static_cast<unsigned long long>(self) << 32));
+        vector<Samples>& own = samples[self];
+        while(true) {
+            unsigned long long ticket = nextTicket.fetch_add(1, memory_order_relaxed);
+            size_t target = ticket % frontierCount;
+            unsigned long long round = ticket / frontierCount;
+            if(round >= 2 && (chrono::steady_clock::now() >= deadline || exactCount.load(memory_order_relaxed) == frontierCount)) {
+                return;
+            }
+            if(round >= 1 && exact[target].load(memory_order_relaxed)) continue;
+            bool chain = true;
+            own[target].add(descend(dirs[frontier[target]].path, cache, random, chain));
+            if(chain && !exact[target].exchange(true)) exactCount.fetch_add(1);
+        }
+    };
+    if(frontierCount > 0) {
+        vector<thread> workers;
+        for(size_t i = 1; i < samples.size(); i++) workers.emplace_back(run, i);
+        run(0);
+        for(thread& worker : workers) worker.join();
+    }
+
+    for(size_t i = 0; i < frontierCount; i++) {
+        Samples merged;
+        for(const vector<Samples>& own : samples) merged.merge(own[i]);
+        EstimatedDir& dir = dirs[frontier[i]];
+        dir.estimate = static_cast<unsigned long long>(llround(max(0.0, merged.mean)));
+        dir.probes = merged.count;
+        // the variance of the mean, a chain has none
+        if(!exact[i] && merged.count > 1) {
+            variance[frontier[i]] = merged.m2 / static_cast<double>(merged.count - 1) / static_cast<double>(merged.count);
+        }
+    }
+    // estimates of independent subtrees add up, and so do their variances
+    for(size_t dir = dirs.size(); dir-- > 1;) {
+        uint32_t parent = dirs[dir].parent;
+        dirs[parent].estimate += dirs[dir].estimate;
+        dirs[parent].probes += dirs[dir].probes;
+        variance[parent] += variance[dir];
+    }
+    for(size_t dir = 0; dir < dirs.size(); dir++) {
+        dirs[dir].bound = static_cast<unsigned long long>(llround(Z_95 * sqrt(variance[dir])));
+    }
+    return dirs;
+}
+
+bool writeEstimateReport(const vector<EstimatedDir>& dirs, const EstimateOptions& options, const RankLimit& limit,
+                         const vector<unsigned long long>& divisions, const fs::path& output) {
+    vector<unsigned long long> estimates(dirs.size());
+    size_t longestPath = 0;
+    for(size_t dir = 0; dir < dirs.size(); dir++) {
+        estimates[dir] = dirs[dir].estimate;
+        longestPath = max(longestPath, dirs[dir].path.native().size());
+    }
+    vector<uint32_t> order = rankBySize(estimates, limit, 1);
+    vector<size_t> ends;
+    auto current = order.begin();
+    for(unsigned long long division : divisions) {
+        current = partition_point(current, order.end(), [&estimates, division](uint32_t dir) { return estimates[dir] >= division; });
+        ends.push_back(static_cast<size_t>(current - order.begin()));
+    }
+    // title, description, blank line, index line, two blank lines
+    SectionLayout layout = layoutSection(7, order.size(), ends);
+
+    return writeFileAtomically(output, [&](ostream& stream) {
+        ReportWriter out(stream);
+        const EstimatedDir& root = dirs.front();
+        ostringstream rootText;
+        rootText << fs::absolute(root.path);
+        out << "Estimated Output " << rootText.str() << " [~";
+        out.size(root.estimate) << " +- ";
+        out.size(root.bound) << "]\n";
+        out << "Listed " << static_cast<unsigned long long>(options.depth) << " levels completely, " << root.probes
+            << " random descents below them, bounds are 95% confidence intervals\n\n";
+        writeIndexLine(out, "Folders estimate", layout, divisions);
+        out << "\n\n\n";
+        out << "==== FOLDERS ESTIMATE START ====\n";
+        RowColumns columns{static_cast<int>(ceil(log10(dirs.size() + 1))) + 3, static_cast<int>(longestPath + 20)};
+        out.padded("Rank", columns.rank).padded("Folder", columns.path);
+        out.padded("Estimate", 20).padded("+- (95%)", 20).endLine();
+        writeSectionRows(out, layout, order.size(), divisions, [&](size_t rank) {
+            const EstimatedDir& dir = dirs[order[rank - 1]];
+            out.estimateRow(columns, rank, dir.path.string(), dir.estimate, dir.bound);
+        });
+    });
+}
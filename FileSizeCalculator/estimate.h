@@ -0,0 +1,44 @@
+#ifndef FILESIZECALCULATOR_ESTIMATE_H
+#define FILESIZECALCULATOR_ESTIMATE_H
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "filter.h"
+#include "rank.h"
+#include "scan.h"
+
+struct EstimateOptions {
+    size_t depth = 2; // levels below the root that are listed completely
+    std::chrono::milliseconds budget{10'000};
+    size_t threads = 1;
+    const ScanFilter* filter = nullptr;
+};
+
+// A folder of the completely listed levels
+struct EstimatedDir {
+    std::filesystem::path path;
+    uint32_t parent;               // NO_DIR for the root
+    unsigned long long estimate;   // full size
+    unsigned long long bound;      // half width of the 95% confidence interval, 0 when exact
+    unsigned long long probes;     // random descents below it
+};
+
+// Estimates the full size of root and of every folder in its first `depth` levels without
+// walking the whole tree. Those levels are listed completely, the size below each folder on
+// the last of them is estimated from random descents: starting there, a random subdirectory
+// is taken at every level, and the files met on the way are weighted by how many
+// subdirectories were passed over (Knuth's tree size estimator, unbiased). Descents repeat on
+// `threads` workers until the budget is used up, so the bounds shrink the longer it runs,
+// but every folder gets at least two. Listings are cached, a descent only lists directories
+// no earlier one reached. Returns the folders in breadth first order, the root first.
+std::vector<EstimatedDir> estimateTree(const std::filesystem::path& root, const EstimateOptions& options, ScanStats& stats);
+
+// Folders ranked by estimate with division markers like the folder sections of the report.
+// Returns false (after printing why) if it could not be written.
+bool writeEstimateReport(const std::vector<EstimatedDir>& dirs, const EstimateOptions& options, const RankLimit& limit,
+                         const std::vector<unsigned long long>& divisions, const std::filesystem::path& output);
+
+#endif //FILESIZECALCULATOR_ESTIMATE_H
@@ -0,0 +1,358 @@
+#include "external.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "report.h"
+#include "scan.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr size_t MERGE_FAN_IN = 64;
+// Below this the stream buffers of a merge alone would use up the budget
+static constexpr unsigned long long MIN_BUDGET = 1 << 20;
+
+// A row waiting in memory, its path is in the shared character buffer. key is the size it is
+// ranked by, other the folder's other size, seq its position in scan order (ScanTree's index,
+// so ties break like rankBySize's).
+struct BufferedRow {
+    unsigned long long key, other, seq;
+    size_t pathStart;
+    size_t pathLength;
+};
+
+// A row read back from a run
+struct RunRow {
+    unsigned long long key = 0, other = 0, seq = 0;
+    string path;
+};
+
+static bool rankedBefore(unsigned long long keyA, unsigned long long seqA, unsigned long long keyB, unsigned long long seqB) {
+    return keyA != keyB ? keyA > keyB : seqA < seqB;
+}
+
+// Runs are rows in rank order: key, other, seq, path length, path
+class RunWriter {
+    ofstream out;
+    vector<char> buffer;
+public:
+    bool open(const fs::path& path, size_t bufferSize) {
+        buffer.resize(bufferSize);
+        out.rdbuf()->pubsetbuf(buffer.data(), static_cast<streamsize>(buffer.size()));
+        out.open(path, ios::binary | ios::trunc);
+        if(!out) cerr << "\nError failed to create run file '" << path.string() << '\'' << endl;
+        return out.is_open();
+    }
+    void write(unsigned long long key, unsigned long long other, unsigned long long seq, string_view path) {
+        uint64_t header[4] = {key, other, seq, path.size()};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(path.data(), static_cast<streamsize>(path.size()));
+    }
+    bool close(const fs::path& path) {
+        out.close();
+        if(out.fail()) cerr << "\nError failed to write run file '" << path.string() << '\'' << endl;
+        return !out.fail();
+    }
+};
+
+class RunReader {
+    ifstream in;
+    vector<char> buffer;
+    bool cut = false;
+public:
+    RunRow row;
+
+    bool open(const fs::path& path, size_t bufferSize) {
+        buffer.resize(bufferSize);
+        in.rdbuf()->pubsetbuf(buffer.data(), static_cast<streamsize>(buffer.size()));
+        in.open(path, ios::binary);
+        if(!in) cerr << "\nError failed to open run file '" << path.string() << '\'' << endl;
+        return in.is_open();
+    }
+    // Reads the next row, false at the end of the run or if it is cut short (failed() tells)
+    bool next() {
+        uint64_t header[4];
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if(in.gcount() != sizeof(header)) {
+            cut = in.gcount() != 0 || !in.eof();
+            return false;
+        }
+        row.key = header[0];
+        row.other = header[1];
+        row.seq = header[2];
+        row.path.resize(header[3]);
+        in.read(row.path.data(), static_cast<streamsize>(row.path.size()));
+        cut = in.gcount() != static_cast<streamsize>(row.path.size());
+        return !cut;
+    }
+    bool failed() const { return cut; }
+};
+
+static size_t runBufferSize(unsigned long long budget) {
+    return static_cast<size_t>(clamp<unsigned long long>(budget / (2 * MERGE_FAN_IN), 64 * 1024, 8 << 20));
+}
+
+// Merges up to MERGE_FAN_IN runs into one sequence in rank order
+class RunMerger {
+    vector<unique_ptr<RunReader>> readers;
+    vector<size_t> heap; // the reader with the next row in front
+    size_t taken = SIZE_MAX;
+    bool broken = false;
+
+    bool after(size_t a, size_t b) const {
+        const RunRow& rowA = readers[a]->row;
+        const RunRow& rowB = readers[b]->row;
+        return rankedBefore(rowB.key, rowB.seq, rowA.key, rowA.seq);
+    }
+    void push(size_t reader) {
+        heap.push_back(reader);
+        push_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return after(a, b); });
+    }
+    void advance(size_t reader) {
+        if(readers[reader]->next()) {
+            push(reader);
+        }else if(readers[reader]->failed()) {
+            broken = true;
+        }
+    }
+public:
+    bool open(const vector<fs::path>& runs, size_t bufferSize) {
+        for(const fs::path& run : runs) {
+            readers.push_back(make_unique<RunReader>());
+            if(!readers.back()->open(run, bufferSize)) return false;
+            advance(readers.size() - 1);
+        }
+        return !broken;
+    }
+    // Moves the next row into row, false at the end (or if a run was cut short, see failed)
+    bool next(RunRow& row) {
+        if(taken != SIZE_MAX) advance(taken);
+        taken = SIZE_MAX;
+        if(heap.empty() || broken) return false;
+        pop_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return after(a, b); });
+        taken = heap.back();
+        heap.pop_back();
+        swap(row, readers[taken]->row);
+        return true;
+    }
+    bool failed() const { return broken; }
+};
+
+// Buffers rows and spills them as sorted runs whenever the budget is used up
+class RunSpiller {
+public:
+    vector<fs::path> fileRuns, fullRuns, pureRuns;
+
+    RunSpiller(fs::path dir, unsigned long long budget, Metrics& metrics) : dir(move(dir)), budget(budget), metrics(metrics) {}
+
+    void file(const string& path, unsigned long long size, unsigned long long seq) {
+        files.push_back({size, 0, seq, chars.size(), path.size()});
+        chars += path;
+        spillIfFull();
+    }
+    void folder(const string& path, unsigned long long full, unsigned long long pure, unsigned long long seq) {
+        folders.push_back({full, pure, seq, chars.size(), path.size()});
+        chars += path;
+        spillIfFull();
+    }
+    // Spills what is left, false if any spill failed
+    bool finish() {
+        spill();
+        return ok;
+    }
+    fs::path newRun() { return dir / ("run-" + to_string(runCount++)); }
+
+private:
+    fs::path dir;
+    unsigned long long budget;
+    Metrics& metrics;
+    vector<BufferedRow> files, folders;
+    string chars;
+    size_t runCount = 0;
+    bool ok = true;
+
+    void spillIfFull() {
+        unsigned long long used = (files.size() + folders.size()) * sizeof(BufferedRow) + chars.size();
+        if(used >= budget) {
+            metrics.start("spill");
+            spill();
+            metrics.start("scan");
+        }
+    }
+    void spill() {
+        writeRun(files, fileRuns);
+        writeRun(folders, fullRuns);
+        // the same folders once more ranked by their pure size
+        for(BufferedRow& row : folders) swap(row.key, row.other);
+        writeRun(folders, pureRuns);
+        files.clear();
+        folders.clear();
+        chars.clear();
+    }
+    void writeRun(vector<BufferedRow>& rows, vector<fs::path>& runs) {
+        if(rows.empty() || !ok) return;
+        sort(rows.begin(), rows.end(), [](const BufferedRow& a, const BufferedRow& b) {
+            return rankedBefore(a.key, a.seq, b.key, b.seq);
+        });
+        fs::path path = newRun();
+        RunWriter writer;
+        ok = writer.open(path, runBufferSize(budget));
+        if(!ok) return;
+        for(const BufferedRow& row : rows) {
+            writer.write(row.key, row.other, row.seq, string_view(chars).substr(row.pathStart, row.pathLength));
+        }
+        ok = writer.close(path);
+        runs.push_back(path);
+    }
+};
+
+// Merges runs MERGE_FAN_IN at a time until at most MERGE_FAN_IN are left
+static bool reduceRuns(vector<fs::path>& runs, RunSpiller& spiller, unsigned long long budget) {
+    while(runs.size() > MERGE_FAN_IN) {
+        vector<fs::path> merged;
+        for(size_t first = 0; first < runs.size(); first += MERGE_FAN_IN) {
+            vector<fs::path> group(runs.begin() + static_cast<ptrdiff_t>(first),
+                                   runs.begin() + static_cast<ptrdiff_t>(min(first + MERGE_FAN_IN, runs.size())));
+            RunMerger merger;
+            RunWriter writer;
+            fs::path path = spiller.newRun();
+            if(!merger.open(group, runBufferSize(budget)) || !writer.open(path, runBufferSize(budget))) return false;
+            RunRow row;
+            while(merger.next(row)) {
+                writer.write(row.key, row.other, row.seq, row.path);
+            }
+            if(merger.failed()) {
+                cerr << "\nError a run file was cut short" << endl;
+                return false;
+            }
+            if(!writer.close(path)) return false;
+            for(const fs::path& run : group) fs::remove(run);
+            merged.push_back(path);
+        }
+        runs.swap(merged);
+    }
+    return true;
+}
+
+// Rows that make it into a ranking, and how many of them reach each division
+static void rankedRows(const vector<unsigned long long>& atLeastDivision, unsigned long long atLeastMinSize,
+                       const RankLimit& limit, size_t& rows, vector<size_t>& divisionEnds) {
+    rows = static_cast<size_t>(min<unsigned long long>(limit.top, atLeastMinSize));
+    divisionEnds.clear();
+    for(unsigned long long count : atLeastDivision) {
+        divisionEnds.push_back(static_cast<size_t>(min<unsigned long long>(rows, count)));
+    }
+}
+
+// Counts of entries at least as big as each division (and as limit.minSize)
+struct SizeCounts {
+    const vector<unsigned long long>& divisions;
+    vector<unsigned long long> atLeast;
+    unsigned long long atLeastMinSize = 0;
+
+    explicit SizeCounts(const vector<unsigned long long>& divisions) : divisions(divisions), atLeast(divisions.size()) {}
+    void add(unsigned long long size, unsigned long long minSize) {
+        for(size_t i = 0; i < divisions.size(); i++) {
+            if(size >= divisions[i]) atLeast[i]++;
+        }
+        if(size >= minSize) atLeastMinSize++;
+    }
+};
+
+bool writeExternalReport(const fs::path& root, const RankLimit& limit, const vector<unsigned long long>& fileDivisions,
+                         const vector<unsigned long long>& folderDivisions, const fs::path& output,
+                         const fs::path& tempDir, unsigned long long memoryBudget, Metrics& metrics,
+                         const ScanFilter* filter, FileGroups* groups, const MessageSink& messages) {
+    memoryBudget = max(memoryBudget, MIN_BUDGET);
+    // runs go into a directory of their own that is removed again whatever happens
+    random_device random;
+    fs::path runDir = tempDir / ("fsc-runs-" + to_string(random()) + to_string(random()));
+    error_code ec;
+    if(!fs::create_directories(runDir, ec)) {
+        cerr << "\nError failed to create '" << runDir.string() << "': " << ec.message() << endl;
+        return false;
+    }
+    struct RemoveRuns {
+        fs::path dir;
+        ~RemoveRuns() {
+            error_code ec;
+            fs::remove_all(dir, ec);
+        }
+    } removeRuns{runDir};
+
+    RunSpiller spiller(runDir, memoryBudget, metrics);
+    SizeCounts fileCounts(fileDivisions), fullCounts(folderDivisions), pureCounts(folderDivisions);
+    unsigned long long fileCount = 0, dirCount = 0;
+    size_t longestPathName = 0;
+    unsigned long long totalSize;
+    metrics.start("scan");
+    {
+        ProgressReporter progress(messages, metrics.scan);
+        totalSize = streamCalc(root, {
+            [&](const fs::path& path, unsigned long long size) {
+                spiller.file(path.string(), size, fileCount++);
+                fileCounts.add(size, limit.minSize);
+                longestPathName = max(longestPathName, path.native().size());
+            },
+            [&](const fs::path& path, unsigned long long full, unsigned long long pure) {
+                spiller.folder(path.string(), full, pure, dirCount++);
+                fullCounts.add(full, limit.minSize);
+                pureCounts.add(pure, limit.minSize);
+            }
+        }, metrics.scan, filter, groups);
+    }
+    sendMessage(messages, MessageLevel::Info,
+                "Finished calculating " + to_string(fileCount) + " files, " + to_string(dirCount) + " directories");
+    metrics.start("spill");
+    if(!spiller.finish()) return false;
+    metrics.start("merge");
+    if(!reduceRuns(spiller.fileRuns, spiller, memoryBudget) || !reduceRuns(spiller.fullRuns, spiller, memoryBudget) ||
+       !reduceRuns(spiller.pureRuns, spiller, memoryBudget)) {
+        return false;
+    }
+
+    metrics.start("write");
+    size_t pathWidth = longestPathName + 20;
+    ReportOutline outline{root, totalSize, static_cast<size_t>(fileCount), static_cast<size_t>(dirCount),
+                          static_cast<int>(min<size_t>(pathWidth, numeric_limits<int>::max())), {}, {},
+                          fileDivisions, folderDivisions};
+    rankedRows(fileCounts.atLeast, fileCounts.atLeastMinSize, limit, outline.rows[0], outline.divisionEnds[0]);
+    rankedRows(fullCounts.atLeast, fullCounts.atLeastMinSize, limit, outline.rows[1], outline.divisionEnds[1]);
+    rankedRows(pureCounts.atLeast, pureCounts.atLeastMinSize, limit, outline.rows[2], outline.divisionEnds[2]);
+
+    sendMessage(messages, MessageLevel::Progress, "Writing...");
+    unique_ptr<RunMerger> merger;
+    ReportSection merging = ReportSection::Files;
+    RunRow row;
+    bool written = writeReport(outline, output, [&](ReportWriter& out, ReportSection section, const RowColumns& columns, size_t rank) {
+        if(!merger || section != merging) {
+            const vector<fs::path>& runs = section == ReportSection::Files ? spiller.fileRuns
+                                         : section == ReportSection::FoldersFull ? spiller.fullRuns : spiller.pureRuns;
+            merger = make_unique<RunMerger>();
+            merging = section;
+            if(!merger->open(runs, runBufferSize(memoryBudget))) return false;
+        }
+        if(!merger->next(row)) {
+            cerr << "\nError a run file was cut short" << endl;
+            return false;
+        }
+        if(section == ReportSection::Files) {
+            out.fileRow(columns, rank, row.path, row.key);
+        }else if(section == ReportSection::FoldersFull) {
+            out.folderRow(columns, rank, row.path, row.key, row.other);
+        }else {
+            out.folderRow(columns, rank, row.path, row.other, row.key);
+        }
+        return true;
+    }, messages);
+    metrics.stop();
+    return written;
+}
@@ -0,0 +1,27 @@
+#ifndef FILESIZECALCULATOR_EXTERNAL_H
+#define FILESIZECALCULATOR_EXTERNAL_H
+
+#include <filesystem>
+#include <vector>
+
+#include "filter.h"
+#include "groups.h"
+#include "metrics.h"
+#include "rank.h"
+
+// Writes the report of root without holding the tree or the rankings in memory, for trees
+// whose rankings do not fit. The scan keeps nothing (streamCalc), file and folder rows are
+// buffered up to about memoryBudget bytes, then sorted into runs under tempDir. The runs are
+// merged, at most 64 at a time, while the report is written. Only counts and division
+// positions stay in memory, so memory does not grow with the number of entries. The report
+// is the one writeReport writes for an in-memory scan of the same tree. Scan progress and
+// each phase are sent to messages.
+// Returns false (after printing why) if it could not be written.
+bool writeExternalReport(const std::filesystem::path& root, const RankLimit& limit,
+                         const std::vector<unsigned long long>& fileDivisions,
+                         const std::vector<unsigned long long>& folderDivisions,
+                         const std::filesystem::path& output, const std::filesystem::path& tempDir,
+                         unsigned long long memoryBudget, Metrics& metrics, const ScanFilter* filter = nullptr,
+                         FileGroups* groups = nullptr, const MessageSink& messages = {});
+
+#endif //FILESIZECALCULATOR_EXTERNAL_H
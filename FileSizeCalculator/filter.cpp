@@ -0,0 +1,226 @@
+#include "filter.h"
+
+#include <algorithm>
+#include <iostream>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr size_t NO_CLASS = PathView::npos;
+
+static bool isWildcard(PathChar c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+// Matches the class that starts at glob[start] ('[') against c. Returns the position after its
+// ']', or NO_CLASS if it is never closed (the '[' is then an ordinary character).
+static size_t matchClass(PathView glob, size_t start, PathChar c, bool& matched) {
+    size_t i = start + 1;
+    bool negate = i < glob.size() && glob[i] == '!';
+    if(negate) i++;
+    matched = false;
+    // a ']' right after the '[' (or "[!") is part of the class
+    for(bool first = true; i < glob.size() && (first || glob[i] != ']'); first = false) {
+        PathChar low = glob[i], high = low;
+        if(i + 2 < glob.size() && glob[i + 1] == '-' && glob[i + 2] != ']') {
+            high = glob[i + 2];
+            i += 3;
+        }else {
+            i++;
+        }
+        if(low <= c && c <= high) matched = true;
+    }
+    if(i >= glob.size()) return NO_CLASS;
+    matched = matched != negate && c != '/';
+    return i + 1;
+}
+
+// Single stars backtrack in place, only ** (which is rare and usually once) recurses
+static bool globMatch(PathView glob, PathView text) {
+    size_t g = 0, t = 0;
+    size_t starGlob = PathView::npos, starText = 0;
+    while(t < text.size()) {
+        if(g < glob.size()) {
+            PathChar c = glob[g];
+            if(c == '*' && g + 1 < glob.size() && glob[g + 1] == '*') {
+                // "**/" may also stand for no directory at all
+                PathView rest = glob.substr(g + 2);
+                if(!rest.empty() && rest.front() == '/' && globMatch(rest.substr(1), text.substr(t))) return true;
+                for(size_t from = t; from <= text.size(); from++) {
+                    if(globMatch(rest, text.substr(from))) return true;
+                }
+            }else if(c == '*') {
+                starGlob = g++;
+                starText = t;
+                continue;
+            }else if(c == '?') {
+                if(text[t] != '/') {
+                    g++;
+                    t++;
+                    continue;
+                }
+            }else if(c == '[') {
+                bool matched;
+                size_t end = matchClass(glob, g, text[t], matched);
+                if(end == NO_CLASS ? text[t] == c : matched) {
+                    g = end == NO_CLASS ? g + 1 : end;
+                    t++;
+                    continue;
+                }
+            }else if(c == text[t]) {
+                g++;
+                t++;
+                continue;
+            }
+        }
+        // the last single * takes one more character, it never crosses a '/'
+        if(starGlob == PathView::npos || text[starText] == '/') return false;
+        g = starGlob + 1;
+        t = ++starText;
+    }
+    while(g < glob.size() && glob[g] == '*') g++;
+    return g == glob.size();
+}
+
+void ScanFilter::RuleSet::add(PathString glob) {
+    bool anchored = !glob.empty() && glob.front() == '/';
+    if(anchored) glob.erase(0, 1);
+    if(glob.empty()) return;
+    if(anchored || glob.find('/') != PathString::npos) {
+        pathGlobs.push_back(std::move(glob));
+        return;
+    }
+    size_t wildcards = count_if(glob.begin(), glob.end(), isWildcard);
+    if(wildcards == 0) {
+        names.insert(std::move(glob));
+    }else if(wildcards == 1 && glob.front() == '*') {
+        suffixes.push_back(glob.substr(1));
+    }else if(wildcards == 1 && glob.back() == '*') {
+        glob.pop_back();
+        prefixes.push_back(std::move(glob));
+    }else {
+        nameGlobs.push_back(std::move(glob));
+    }
+}
+
+bool ScanFilter::RuleSet::empty() const {
+    return names.empty() && suffixes.empty() && prefixes.empty() && nameGlobs.empty() && !needsPath();
+}
+
+bool ScanFilter::RuleSet::matches(PathView name, PathView path) const {
+    if(!names.empty() && names.find(name) != names.end()) return true;
+    for(const PathString& suffix : suffixes) {
+        if(name.ends_with(suffix)) return true;
+    }
+    for(const PathString& prefix : prefixes) {
+        if(name.starts_with(prefix)) return true;
+    }
+    for(const PathString& glob : nameGlobs) {
+        if(globMatch(glob, name)) return true;
+    }
+    for(const PathString& glob : pathGlobs) {
+        if(globMatch(glob, path)) return true;
+    }
+    for(const basic_regex<PathChar>& regex : regexes) {
+        if(regex_search(path.begin(), path.end(), regex)) return true;
+    }
+    return false;
+}
+
+void ScanFilter::exclude(const string& glob) {
+    PathString native = fs::path(glob).native();
+    bool dirsOnly = native.size() > 1 && native.back() == '/';
+    if(dirsOnly) native.pop_back();
+    (dirsOnly ? excludedDirs : excluded).add(std::move(native));
+    needsPath = needsPath || excluded.needsPath() || excludedDirs.needsPath();
+    description += "exclude " + glob + '\n';
+}
+
+void ScanFilter::include(const string& glob) {
+    PathString native = fs::path(glob).native();
+    if(native.size() > 1 && native.back() == '/') native.pop_back(); // only files are picked anyway
+    included.add(std::move(native));
+    needsPath = needsPath || included.needsPath();
+    description += "include " + glob + '\n';
+}
+
+bool ScanFilter::addRegex(RuleSet& rules, const string& pattern) {
+    try {
+        rules.regexes.emplace_back(fs::path(pattern).native(), regex_constants::ECMAScript | regex_constants::optimize);
+    }catch(const regex_error& err) {
+        cerr << "Error invalid regex '" << pattern << "': " << err.what() << endl;
+        return false;
+    }
+    needsPath = true;
+    return true;
+}
+
+bool ScanFilter::excludeRegex(const string& pattern) {
+    if(!addRegex(excluded, pattern)) return false;
+    description += "exclude-regex " + pattern + '\n';
+    return true;
+}
+
+bool ScanFilter::includeRegex(const string& pattern) {
+    if(!addRegex(included, pattern)) return false;
+    description += "include-regex " + pattern + '\n';
+    return true;
+}
+
+void ScanFilter::oneFileSystem() {
+    if(stayOnDevice) return;
+    stayOnDevice = true;
+    description += "one-file-system\n";
+}
+
+bool ScanFilter::prepare(const fs::path& root) {
+    rootLength = root.native().size();
+    if(!stayOnDevice) return true;
+#ifdef __linux__
+    struct stat st{};
+    if(stat(root.c_str(), &st) != 0) {
+        cerr << "Error failed to stat '" << root.string() << "': " << error_code(errno, system_category()).message() << endl;
+        return false;
+    }
+    rootDevice = st.st_dev;
+    return true;
+#else
+    cerr << "Error --one-file-system is only available on Linux" << endl;
+    return false;
+#endif
+}
+
+bool ScanFilter::otherDevice(const fs::path& dir) const {
+    if(!stayOnDevice) return false;
+#ifdef __linux__
+    struct stat st{};
+    return stat(dir.c_str(), &st) == 0 && otherDevice(st.st_dev);
+#else
+    return false;
+#endif
+}
+
+void ScanFilter::relativePath(PathView parent, PathView name, PathString& out) const {
+    out.clear();
+    if(parent.size() > rootLength) {
+        PathView below = parent.substr(rootLength);
+        if(below.front() == '/' || below.front() == fs::path::preferred_separator) below.remove_prefix(1);
+        out += below;
+        out += '/';
+    }
+    out += name;
+}
+
+bool ScanFilter::skips(PathView parent, PathView name, bool isDirectory) const {
+    // only built when a rule looks at it, matches() ignores it otherwise
+    static thread_local PathString path;
+    if(needsPath) relativePath(parent, name, path);
+    if(excluded.matches(name, path)) return true;
+    if(isDirectory) return excludedDirs.matches(name, path);
+    return !included.empty() && !included.matches(name, path);
+}
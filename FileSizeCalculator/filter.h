@@ -0,0 +1,75 @@
+#ifndef FILESIZECALCULATOR_FILTER_H
+#define FILESIZECALCULATOR_FILTER_H
+
+#include <filesystem>
+#include <functional>
+#include <regex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "tree.h"
+
+// Entries a scan leaves out, from --exclude/--include rules. Rules are compiled once when they
+// are added: names without wildcards go into a hash set, "*.ext" and "prefix*" become suffix and
+// prefix compares, only the rest needs a glob match. A glob with a '/' and every regex are
+// matched against the path relative to the root, which is only built when such a rule exists.
+// Excluded directories are never opened. Include rules pick files only, every directory that is
+// not excluded is still scanned for them.
+class ScanFilter {
+public:
+    // * and ? do not match '/', ** does. [abc], [a-z] and [!abc] match one character.
+    // A leading '/' anchors a rule at the root, a trailing '/' makes an exclude match directories only.
+    void exclude(const std::string& glob);
+    void include(const std::string& glob);
+    // ECMAScript regexes searched in the relative path.
+    // Return false (after printing why) if the pattern does not compile.
+    bool excludeRegex(const std::string& pattern);
+    bool includeRegex(const std::string& pattern);
+    // Directories on another device than the root (mount points) are left out
+    void oneFileSystem();
+
+    // Takes the root's device for oneFileSystem, false (after printing why) if it cannot be stat'ed
+    bool prepare(const std::filesystem::path& root);
+
+    bool empty() const { return description.empty(); }
+    // The rules as they were given, a snapshot can only be reused by a scan with the same ones
+    const std::string& rules() const { return description; }
+
+    // Whether the entry `name` inside the directory `parent` (the root or a path below it) is left out
+    bool skips(PathView parent, PathView name, bool isDirectory) const;
+    bool sameFileSystem() const { return stayOnDevice; }
+    // Whether a directory on `device` is left out by oneFileSystem
+    bool otherDevice(unsigned long long device) const { return stayOnDevice && device != rootDevice; }
+    // Same, stat'ing the directory (false if that fails, the scan then reports the error)
+    bool otherDevice(const std::filesystem::path& dir) const;
+
+private:
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(PathView name) const { return std::hash<PathView>{}(name); }
+    };
+
+    struct RuleSet {
+        std::unordered_set<PathString, NameHash, std::equal_to<>> names;
+        std::vector<PathString> suffixes, prefixes, nameGlobs, pathGlobs;
+        std::vector<std::basic_regex<PathChar>> regexes;
+
+        void add(PathString glob);
+        bool empty() const;
+        bool needsPath() const { return !pathGlobs.empty() || !regexes.empty(); }
+        bool matches(PathView name, PathView path) const;
+    };
+
+    RuleSet excluded, excludedDirs, included;
+    bool needsPath = false;
+    bool stayOnDevice = false;
+    unsigned long long rootDevice = 0;
+    size_t rootLength = 0;
+    std::string description;
+
+    void relativePath(PathView parent, PathView name, PathString& out) const;
+    bool addRegex(RuleSet& rules, const std::string& pattern);
+};
+
+#endif //FILESIZECALCULATOR_FILTER_H
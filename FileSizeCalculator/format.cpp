@@ -0,0 +1,268 @@
+#include "format.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+static void appendUnsigned(string& out, unsigned long long value) {
+    char digits[20];
+    auto result = to_chars(begin(digits), end(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// Same text as `out << fixed << setprecision(4) << value`
+static void appendFixed4(string& out, double value) {
+    char digits[32];
+    auto result = to_chars(begin(digits), end(digits), value, chars_format::fixed, 4);
+    out.append(digits, result.ptr);
+}
+
+void appendSizeRepr(string& out, unsigned long long bytes) {
+    if(bytes >= GB_BYTES) {
+        if(bytes % GB_BYTES == 0) {
+            appendUnsigned(out, bytes / GB_BYTES);
+        }else {
+            appendFixed4(out, (double) bytes / GB_BYTES);
+        }
+        out += " GB";
+    }else if(bytes >= MB_BYTES) {
+        if(bytes % MB_BYTES == 0) {
+            appendUnsigned(out, bytes / MB_BYTES);
+        }else {
+            appendFixed4(out, (double) bytes / MB_BYTES);
+        }
+        out += " MB";
+    }else if(bytes >= KB_BYTES) {
+        if(bytes % KB_BYTES == 0) {
+            appendUnsigned(out, bytes / KB_BYTES);
+        }else {
+            appendFixed4(out, (double) bytes / KB_BYTES);
+        }
+        out += " KB";
+    }else {
+        appendUnsigned(out, bytes);
+        out += " B";
+    }
+}
+
+string size_repr(unsigned long long bytes) {
+    string out;
+    appendSizeRepr(out, bytes);
+    return out;
+}
+
+static const unsigned long long ULL_MAX = numeric_limits<unsigned long long>::max();
+
+void parseDivisions(string& input, vector<unsigned long long>& output) {
+    if(input.empty()) return;
+    transform(input.begin(), input.end(),
+              input.begin(), ::tolower);
+
+    // split by ','
+    size_t start = 0;
+    size_t delimiterPos; // delimiter is ','
+    while(true) {
+        bool breakAfterThis = false;
+        if((delimiterPos = input.find(',', start)) == string::npos) {
+            breakAfterThis = true;
+            delimiterPos = input.size(); // -1 for right
+        }
+        size_t left = start;
+        size_t right = delimiterPos - 1;
+//        size < 2
+//       right - left + 1 < 2
+//       right - left < 1
+        if(right - left < 1) {
+            // not enough size
+            throw invalid_argument("invalid division length '" + input.substr(left, delimiterPos-left) + "'");
+        }
+        // do something with left -> right
+        // check suffix
+        if(input[right] != 'b') { // has to be! GB,MB,KB,B
+            throw invalid_argument("invalid division suffix '" + input.substr(left, delimiterPos-left) + "'");
+        }
+
+        char secondLast = input[right-1];
+        unsigned long long multiplier;
+        if(secondLast == 'g') {
+            multiplier = GB_BYTES;
+            right -= 2;
+        }else if(secondLast == 'm') {
+            multiplier = MB_BYTES;
+            right -= 2;
+        }else if(secondLast == 'k') {
+            multiplier = KB_BYTES;
+            right -= 2;
+        }else {
+            // byte?
+            multiplier = 1;
+            right--;
+            if(!('0' <= input[right] && input[right] <= '9')) {
+                // not a Byte
+                throw invalid_argument("invalid division size type '" + input.substr(left, delimiterPos-left) + "'");
+            }
+        }
+        if(left > right) {
+            throw invalid_argument("invalid division length after suffix '" + input.substr(left, delimiterPos-left) + "'");
+        }
+        // convert substr left->right into ull
+        long double value = stold(input.substr(left,right+1-left));
+        long double bytes = value * multiplier;
+        if(bytes >= ULL_MAX) {
+            throw invalid_argument("division size above unsigned long long max '" + input.substr(left, delimiterPos-left) + "'");
+        }
+        output.push_back(static_cast<long long>(bytes));
+        start = delimiterPos+1;
+        if(breakAfterThis) break;
+    }
+}
+
+// Paths are appended in place where the native encoding is already char
+template<typename Buffer>
+static void appendFilePath(const ScanTree& tree, uint32_t file, Buffer& out) {
+    if constexpr(is_same_v<Buffer, PathString>) {
+        tree.appendFilePath(file, out);
+    }else {
+        out += tree.filePath(file);
+    }
+}
+
+template<typename Buffer>
+static void appendDirPath(const ScanTree& tree, uint32_t dir, Buffer& out) {
+    if constexpr(is_same_v<Buffer, PathString>) {
+        tree.appendDirPath(dir, out);
+    }else {
+        out += tree.dirPath(dir);
+    }
+}
+
+ReportWriter::ReportWriter(ostream& out, size_t blockSize) : out(out), blockSize(blockSize) {
+    // a row never reallocates unless it is longer than the slack
+    buffer.reserve(blockSize + 64 * 1024);
+}
+
+ReportWriter& ReportWriter::operator<<(unsigned long long value) {
+    appendUnsigned(buffer, value);
+    return *this;
+}
+
+ReportWriter& ReportWriter::padded(string_view text, int width) {
+    size_t start = buffer.size();
+    buffer.append(text);
+    padFrom(start, width);
+    return *this;
+}
+
+void ReportWriter::rankColumn(size_t rank, int width) {
+    size_t start = buffer.size();
+    appendUnsigned(buffer, rank);
+    buffer += ". ";
+    padFrom(start, width);
+}
+
+void ReportWriter::fileRow(const ScanTree& tree, const RowColumns& columns, size_t rank, uint32_t file) {
+    rankColumn(rank, columns.rank);
+    size_t start = buffer.size();
+    buffer += '\'';
+    appendFilePath(tree, file, buffer);
+    buffer += '\'';
+    padFrom(start, columns.path);
+    start = buffer.size();
+    appendSizeRepr(buffer, tree.fileSize[file]);
+    padFrom(start, 20);
+    endLine();
+}
+
+void ReportWriter::folderRow(const ScanTree& tree, const RowColumns& columns, size_t rank, uint32_t dir) {
+    rankColumn(rank, columns.rank);
+    size_t start = buffer.size();
+    buffer += '\'';
+    appendDirPath(tree, dir, buffer);
+    buffer += '\'';
+    padFrom(start, columns.path);
+    start = buffer.size();
+    appendSizeRepr(buffer, tree.dirFull[dir]);
+    padFrom(start, 20);
+    start = buffer.size();
+    appendSizeRepr(buffer, tree.dirPure[dir]);
+    padFrom(start, 20);
+    endLine();
+}
+
+void ReportWriter::fileRow(const RowColumns& columns, size_t rank, string_view path, unsigned long long size) {
+    rankColumn(rank, columns.rank);
+    size_t start = buffer.size();
+    buffer += '\'';
+    buffer += path;
+    buffer += '\'';
+    padFrom(start, columns.path);
+    start = buffer.size();
+    appendSizeRepr(buffer, size);
+    padFrom(start, 20);
+    endLine();
+}
+
+void ReportWriter::folderRow(const RowColumns& columns, size_t rank, string_view path,
+                             unsigned long long sizeWithFolders, unsigned long long sizeNoFolders) {
+    rankColumn(rank, columns.rank);
+    size_t start = buffer.size();
+    buffer += '\'';
+    buffer += path;
+    buffer += '\'';
+    padFrom(start, columns.path);
+    start = buffer.size();
+    appendSizeRepr(buffer, sizeWithFolders);
+    padFrom(start, 20);
+    start = buffer.size();
+    appendSizeRepr(buffer, sizeNoFolders);
+    padFrom(start, 20);
+    endLine();
+}
+
+void ReportWriter::groupRow(const RowColumns& columns, size_t rank, string_view name,
+                            unsigned long long files, unsigned long long bytes) {
+    rankColumn(rank, columns.rank);
+    size_t start = buffer.size();
+    buffer += name;
+    padFrom(start, columns.path);
+    start = buffer.size();
+    appendUnsigned(buffer, files);
+    padFrom(start, 20);
+    start = buffer.size();
+    appendSizeRepr(buffer, bytes);
+    padFrom(start, 20);
+    endLine();
+}
+
+void ReportWriter::estimateRow(const RowColumns& columns, size_t rank, string_view path,
+                               unsigned long long estimate, unsigned long long bound) {
+    rankColumn(rank, columns.rank);
+    size_t start = buffer.size();
+    buffer += '\'';
+    buffer += path;
+    buffer += '\'';
+    padFrom(start, columns.path);
+    start = buffer.size();
+    appendSizeRepr(buffer, estimate);
+    padFrom(start, 20);
+    start = buffer.size();
+    if(bound == 0) {
+        buffer += "exact";
+    }else {
+        buffer += "+- ";
+        appendSizeRepr(buffer, bound);
+    }
+    padFrom(start, 20);
+    endLine();
+}
+
+void ReportWriter::flush() {
+    if(buffer.empty()) return;
+    out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+    buffer.clear();
+}
@@ -0,0 +1,77 @@
+#ifndef FILESIZECALCULATOR_FORMAT_H
+#define FILESIZECALCULATOR_FORMAT_H
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tree.h"
+
+const unsigned long long GB_BYTES = 1024*1024*1024;
+const unsigned long long MB_BYTES = 1024*1024;
+const unsigned long long KB_BYTES = 1024;
+
+// Human readable size: "512 B", "3 KB", "1.5000 MB" (4 decimals unless it is a whole unit)
+void appendSizeRepr(std::string& out, unsigned long long bytes);
+std::string size_repr(unsigned long long bytes);
+
+// Parses sizes like "10gb,1gb,500b" (lower case is applied to input) and appends them to output.
+// Throws std::invalid_argument on malformed sizes.
+void parseDivisions(std::string& input, std::vector<unsigned long long>& output);
+
+// Column widths of a ranking section
+struct RowColumns {
+    int rank; // "123. "
+    int path; // "'/quoted/path'"
+};
+
+// Report text is formatted straight into one reusable buffer that is handed to the stream
+// in large blocks, rows never build temporary strings. Columns are padded like
+// `setw(width) << left`: short fields are filled with spaces, long ones are left as is.
+class ReportWriter {
+    std::ostream& out;
+    std::string buffer;
+    size_t blockSize;
+public:
+    explicit ReportWriter(std::ostream& out, size_t blockSize = 1 << 20);
+    ReportWriter(const ReportWriter&) = delete;
+    ReportWriter& operator=(const ReportWriter&) = delete;
+    ~ReportWriter() { flush(); }
+
+    ReportWriter& operator<<(std::string_view text) { buffer.append(text); return *this; }
+    ReportWriter& operator<<(char c) { buffer.push_back(c); return *this; }
+    ReportWriter& operator<<(unsigned long long value);
+    ReportWriter& size(unsigned long long bytes) { appendSizeRepr(buffer, bytes); return *this; }
+    ReportWriter& padded(std::string_view text, int width);
+
+    // One ranking row: rank, quoted path, size(s)
+    void fileRow(const ScanTree& tree, const RowColumns& columns, size_t rank, uint32_t file);
+    void folderRow(const ScanTree& tree, const RowColumns& columns, size_t rank, uint32_t dir);
+    // The same rows for entries that are not in a tree
+    void fileRow(const RowColumns& columns, size_t rank, std::string_view path, unsigned long long size);
+    void folderRow(const RowColumns& columns, size_t rank, std::string_view path,
+                   unsigned long long sizeWithFolders, unsigned long long sizeNoFolders);
+    // A grouped total: rank, group name (unquoted), file count, size
+    void groupRow(const RowColumns& columns, size_t rank, std::string_view name,
+                  unsigned long long files, unsigned long long bytes);
+    // An estimated folder: rank, quoted path, estimate, confidence bound ("exact" when 0)
+    void estimateRow(const RowColumns& columns, size_t rank, std::string_view path,
+                     unsigned long long estimate, unsigned long long bound);
+
+    // Ends the line and hands the buffer to the stream once a block is full
+    void endLine() {
+        buffer.push_back('\n');
+        if(buffer.size() >= blockSize) flush();
+    }
+    void flush();
+
+private:
+    void padFrom(size_t start, int width) {
+        size_t written = buffer.size() - start;
+        if(width > 0 && written < static_cast<size_t>(width)) buffer.append(static_cast<size_t>(width) - written, ' ');
+    }
+    void rankColumn(size_t rank, int width);
+};
+
+#endif //FILESIZECALCULATOR_FORMAT_H
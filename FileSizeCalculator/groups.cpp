@@ -0,0 +1,225 @@
+#include "groups.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "output.h"
+#include "report.h"
+
+#ifdef __linux__
+#include <pwd.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr long long DAY_NANOS = 24ll * 60 * 60 * 1'000'000'000;
+
+// Files younger than `below` (and not in an earlier bucket), the last bucket takes the rest
+struct AgeBucket {
+    long long below;
+    const char* name;
+};
+
+static constexpr AgeBucket AGE_BUCKETS[] = {
+    {DAY_NANOS, "< 1 day"},
+    {7 * DAY_NANOS, "< 1 week"},
+    {30 * DAY_NANOS, "< 1 month"},
+    {91 * DAY_NANOS, "< 3 months"},
+    {365 * DAY_NANOS, "< 1 year"},
+    {3 * 365 * DAY_NANOS, "< 3 years"},
+    {0, ">= 3 years"}
+};
+static constexpr size_t AGE_COUNT = size(AGE_BUCKETS);
+static constexpr size_t AGE_UNKNOWN = AGE_COUNT; // one more bucket for files without an mtime
+
+FileGroups::FileGroups(vector<GroupKey> keys, long long now) : keys(std::move(keys)), now(now) {
+    for(GroupKey key : this->keys) {
+        byExtension = byExtension || key == GroupKey::Extension;
+        byOwner = byOwner || key == GroupKey::Owner;
+        byAge = byAge || key == GroupKey::Age;
+    }
+}
+
+void FileGroups::prepare(size_t count) {
+    if(workers.size() >= count) return;
+    workers.resize(count);
+    for(Tables& tables : workers) tables.ages.resize(AGE_COUNT + 1);
+}
+
+void FileGroups::add(size_t worker, PathView name, unsigned long long size, const FileStamp& stamp) {
+    Tables& tables = workers[worker];
+    if(byExtension) {
+        // a leading dot is a hidden file, not an extension
+        size_t dot = name.rfind('.');
+        PathView extension = dot == PathView::npos || dot == 0 ? PathView() : name.substr(dot + 1);
+        tables.lowered.assign(extension);
+        for(PathChar& c : tables.lowered) {
+            if(c >= 'A' && c <= 'Z') c = static_cast<PathChar>(c - 'A' + 'a');
+        }
+        auto found = tables.extensions.find(PathView(tables.lowered));
+        if(found == tables.extensions.end()) found = tables.extensions.emplace(tables.lowered, Total()).first;
+        found->second.add(size);
+    }
+    if(byOwner) {
+        tables.owners[stamp.owner].add(size);
+    }
+    if(byAge) {
+        size_t bucket = AGE_UNKNOWN;
+        if(stamp.mtime != 0) {
+            long long age = now - stamp.mtime;
+            for(bucket = 0; bucket + 1 < AGE_COUNT && age >= AGE_BUCKETS[bucket].below; bucket++) {}
+        }
+        tables.ages[bucket].add(size);
+    }
+}
+
+static string ownerName(uint32_t owner) {
+    if(owner == NO_OWNER) return "(unknown)";
+#ifdef __linux__
+    passwd entry{};
+    passwd* found = nullptr;
+    vector<char> buffer(4096);
+    if(getpwuid_r(owner, &entry, buffer.data(), buffer.size(), &found) == 0 && found) {
+        return string(found->pw_name) + " (" + to_string(owner) + ")";
+    }
+#endif
+    return to_string(owner);
+}
+
+vector<GroupRow> FileGroups::table(GroupKey key) const {
+    vector<GroupRow> rows;
+    if(key == GroupKey::Extension) {
+        unordered_map<PathString, Total> merged;
+        for(const Tables& tables : workers) {
+            for(const auto& [extension, total] : tables.extensions) {
+                Total& sum = merged[extension];
+                sum.files += total.files;
+                sum.bytes += total.bytes;
+            }
+        }
+        for(const auto& [extension, total] : merged) {
+            rows.push_back({extension.empty() ? "(none)" : "." + fs::path(extension).string(), total.files, total.bytes});
+        }
+    }else if(key == GroupKey::Owner) {
+        unordered_map<uint32_t, Total> merged;
+        for(const Tables& tables : workers) {
+            for(const auto& [owner, total] : tables.owners) {
+                Total& sum = merged[owner];
+                sum.files += total.files;
+                sum.bytes += total.bytes;
+            }
+        }
+        for(const auto& [owner, total] : merged) {
+            rows.push_back({ownerName(owner), total.files, total.bytes});
+        }
+    }else {
+        for(size_t bucket = 0; bucket <= AGE_COUNT; bucket++) {
+            Total sum;
+            for(const Tables& tables : workers) {
+                sum.files += tables.ages[bucket].files;
+                sum.bytes += tables.ages[bucket].bytes;
+            }
+            if(sum.files > 0) rows.push_back({bucket == AGE_UNKNOWN ? "(unknown)" : AGE_BUCKETS[bucket].name, sum.files, sum.bytes});
+        }
+    }
+    sort(rows.begin(), rows.end(), [](const GroupRow& a, const GroupRow& b) {
+        return a.bytes != b.bytes ? a.bytes > b.bytes : a.name < b.name;
+    });
+    return rows;
+}
+
+vector<GroupKey> parseGroupKeys(const string& input) {
+    vector<GroupKey> keys;
+    stringstream names(input);
+    string name;
+    while(getline(names, name, ',')) {
+        GroupKey key;
+        if(name == "ext") {
+            key = GroupKey::Extension;
+        }else if(name == "owner") {
+            key = GroupKey::Owner;
+        }else if(name == "age") {
+            key = GroupKey::Age;
+        }else {
+            throw invalid_argument("unknown group '" + name + "' (ext, owner or age)");
+        }
+        if(find(keys.begin(), keys.end(), key) == keys.end()) keys.push_back(key);
+    }
+    if(keys.empty()) throw invalid_argument("no group given");
+    return keys;
+}
+
+static const char* tableTitle(GroupKey key) {
+    switch(key) {
+        case GroupKey::Extension: return "Extensions";
+        case GroupKey::Owner: return "Owners";
+        default: return "Ages";
+    }
+}
+
+static const char* columnTitle(GroupKey key) {
+    switch(key) {
+        case GroupKey::Extension: return "Extension";
+        case GroupKey::Owner: return "Owner";
+        default: return "Modified";
+    }
+}
+
+bool writeGroupReport(const FileGroups& groups, const fs::path& root,
+                      const vector<unsigned long long>& divisions, const fs::path& output) {
+    const vector<GroupKey>& keys = groups.groupedBy();
+    vector<vector<GroupRow>> tables;
+    vector<SectionLayout> layouts;
+    // title, blank line, one index line per table, two blank lines, then the tables separated by a blank line
+    unsigned long long line = keys.size() + 5;
+    unsigned long long totalSize = 0;
+    for(GroupKey key : keys) {
+        tables.push_back(groups.table(key));
+        const vector<GroupRow>& rows = tables.back();
+        // every table splits up the same files
+        totalSize = 0;
+        for(const GroupRow& row : rows) totalSize += row.bytes;
+        vector<size_t> ends;
+        auto current = rows.begin();
+        for(unsigned long long division : divisions) {
+            current = partition_point(current, rows.end(), [division](const GroupRow& row) { return row.bytes >= division; });
+            ends.push_back(static_cast<size_t>(current - rows.begin()));
+        }
+        layouts.push_back(layoutSection(line, rows.size(), ends));
+        line = layouts.back().nextLine + 1;
+    }
+
+    return writeFileAtomically(output, [&](ostream& stream) {
+        ReportWriter out(stream);
+        ostringstream rootText;
+        rootText << fs::absolute(root);
+        out << "Grouped Output " << rootText.str() << " [";
+        out.size(totalSize) << "]\n\n";
+        for(size_t i = 0; i < keys.size(); i++) {
+            writeIndexLine(out, tableTitle(keys[i]), layouts[i], divisions);
+            out << '\n';
+        }
+        out << "\n\n";
+        for(size_t i = 0; i < keys.size(); i++) {
+            const vector<GroupRow>& rows = tables[i];
+            if(i > 0) out << '\n';
+            string title = tableTitle(keys[i]);
+            transform(title.begin(), title.end(), title.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+            out << "==== " << title << " START ====\n";
+            size_t nameWidth = 20;
+            for(const GroupRow& row : rows) nameWidth = max(nameWidth, row.name.size() + 2);
+            RowColumns columns{static_cast<int>(ceil(log10(rows.size() + 1))) + 3, static_cast<int>(nameWidth)};
+            out.padded("Rank", columns.rank).padded(columnTitle(keys[i]), columns.path);
+            out.padded("Files", 20).padded("Size", 20).endLine();
+            writeSectionRows(out, layouts[i], rows.size(), divisions, [&](size_t rank) {
+                const GroupRow& row = rows[rank - 1];
+                out.groupRow(columns, rank, row.name, row.files, row.bytes);
+            });
+        }
+    });
+}
@@ -0,0 +1,86 @@
+#ifndef FILESIZECALCULATOR_GROUPS_H
+#define FILESIZECALCULATOR_GROUPS_H
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tree.h"
+
+enum class GroupKey {
+    Extension, // lower case, after the last '.' of the name ("(none)" without one)
+    Owner,     // owning uid (Linux only)
+    Age        // time since the last modification, in buckets
+};
+
+constexpr uint32_t NO_OWNER = UINT32_MAX;
+
+// What the scan knows about a file besides its size, only filled in when a grouping needs it
+struct FileStamp {
+    uint32_t owner = NO_OWNER;
+    long long mtime = 0; // in the unit of ScanTree::dirMtime, 0 if unknown
+};
+
+struct GroupRow {
+    std::string name;
+    unsigned long long files = 0, bytes = 0;
+};
+
+// Totals of files by extension, owner and age, collected while the scan lists the files so
+// nothing is looked at twice. Every scan worker adds to its own tables, they are only merged
+// when a table is asked for.
+class FileGroups {
+public:
+    // Ages are counted back from `now`
+    FileGroups(std::vector<GroupKey> keys, long long now);
+
+    // Tables for `workers` threads adding at the same time (worker = 0 .. workers - 1)
+    void prepare(size_t workers);
+    // Whether the scan has to fill in the FileStamp (owner or age is grouped)
+    bool needsStamp() const { return byOwner || byAge; }
+
+    void add(size_t worker, PathView name, unsigned long long size, const FileStamp& stamp);
+
+    const std::vector<GroupKey>& groupedBy() const { return keys; }
+    // Every group of `key`, biggest first, equal sizes by name
+    std::vector<GroupRow> table(GroupKey key) const;
+
+private:
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(PathView name) const { return std::hash<PathView>{}(name); }
+    };
+    struct Total {
+        unsigned long long files = 0, bytes = 0;
+
+        void add(unsigned long long size) {
+            files++;
+            bytes += size;
+        }
+    };
+    // One per worker, aligned so that counters of two workers never share a cache line
+    struct alignas(64) Tables {
+        std::unordered_map<PathString, Total, NameHash, std::equal_to<>> extensions;
+        std::unordered_map<uint32_t, Total> owners;
+        std::vector<Total> ages;
+        PathString lowered; // scratch for the extension
+    };
+
+    std::vector<GroupKey> keys;
+    bool byExtension = false, byOwner = false, byAge = false;
+    long long now;
+    std::vector<Tables> workers;
+};
+
+// Parses "ext,owner,age" into keys. Throws std::invalid_argument on unknown names.
+std::vector<GroupKey> parseGroupKeys(const std::string& input);
+
+// Writes one ranked table per grouped key with division markers like the folder sections of
+// the report. Returns false (after printing why) if it could not be written.
+bool writeGroupReport(const FileGroups& groups, const std::filesystem::path& root,
+                      const std::vector<unsigned long long>& divisions, const std::filesystem::path& output);
+
+#endif //FILESIZECALCULATOR_GROUPS_H
@@ -1,163 +1,268 @@
 
-#include <fstream>
 #include <iostream>
 #include <filesystem>
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <numeric>
-#include <iomanip>
-#include <cmath>
-#include <unordered_map>
-#include <random>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <optional>
+
+#include "scan.h"
+#include "rank.h"
+#include "report.h"
+#include "results.h"
+#include "query.h"
+#include "diff.h"
+#include "snapshot.h"
+#include "watch.h"
+#include "stream.h"
+#include "metrics.h"
+#include "dedupe.h"
+#include "external.h"
+#include "filter.h"
+#include "groups.h"
+#include "estimate.h"
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
 
 using namespace std;
 namespace fs = std::filesystem;
 
-const unsigned long long GB_BYTES = 1024*1024*1024;
-const unsigned long long MB_BYTES = 1024*1024;
-const unsigned long long KB_BYTES = 1024;
-const unsigned long long ULL_MAX = numeric_limits<unsigned long long>::max();
-
-string size_repr(unsigned long long bytes) {
-    stringstream out;
-    out << fixed << setprecision(4);
-    if(bytes >= GB_BYTES) {
-        if(bytes % GB_BYTES == 0) {
-            out << (bytes / GB_BYTES) << " GB";
-        }else {
-            out << ((double) bytes / GB_BYTES) << " GB";
-        }
-    }else if(bytes >= MB_BYTES) {
-        if(bytes % MB_BYTES == 0) {
-            out << (bytes / MB_BYTES) << " MB";
-        }else {
-            out << ((double) bytes / MB_BYTES) << " MB";
-        }
-    }else if(bytes >= KB_BYTES) {
-        if(bytes % KB_BYTES == 0) {
-            out << (bytes / KB_BYTES) << " KB";
-        }else {
-            out << ((double) bytes / KB_BYTES) << " KB";
-        }
-    }else {
-        out << bytes << " B";
+int main(int argc, char* argv[]) {
+    if(argc > 1 && string(argv[1]) == "query") {
+        return runQuery(argc - 1, argv + 1);
     }
-    return out.str();
-}
-
-unsigned long long recursiveCalc(vector<pair<fs::path, unsigned long long>>& fileSizes,
-                   vector<pair<fs::path, unsigned long long>>& folderSizes,
-                   vector<pair<fs::path, unsigned long long>>& folderSizesPure,
-                   size_t& longestPathName,
-                   const fs::path& root,
-                   const fs::path& path) {
-    unsigned long long sizeWithFolders = 0;
-    unsigned long long sizeNoFolders = 0;
-    fs::directory_iterator directoryIterator;
-    try {
-        directoryIterator = fs::directory_iterator(path);
-    }catch(const fs::filesystem_error& err) {
-        cerr << "\rerr directory_iterator " << absolute(path) << ": " << err.what() << "\n\r" << flush;
-        return 0;
+    if(argc > 1 && string(argv[1]) == "diff") {
+        return runDiff(argc - 1, argv + 1);
     }
-    for(const fs::directory_entry& entry : directoryIterator) {
-        if(entry.is_directory()) {
-            sizeWithFolders += recursiveCalc(fileSizes,
-                                             folderSizes, folderSizesPure, longestPathName, root, entry.path());
-        }else {
-            unsigned long long fileSize = 0ull;
+#ifdef __unix__
+    // the native backend keeps the fds of directories still being listed open, up to half of
+    // the soft limit, so the scan gets all the process may have
+    rlimit fileLimit{};
+    if(getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+#endif
+    size_t threads = max(1u, thread::hardware_concurrency());
+    ScanBackend backend = nativeBackendAvailable() ? ScanBackend::Native : ScanBackend::Portable;
+    bool threadsGiven = false, backendGiven = false;
+    RankLimit rankLimit;
+    fs::path snapshotPath, resultsPath, metricsJsonPath, dedupePath, groupsPath;
+    vector<GroupKey> groupKeys{GroupKey::Extension, GroupKey::Owner, GroupKey::Age};
+    bool groupKeysGiven = false;
+    unsigned long long memoryBudget = 0;
+    fs::path tempDir;
+    bool printMetrics = false;
+    ScanFilter filter;
+    long long watchSeconds = 0;
+    long long estimateSeconds = 0;
+    size_t estimateDepth = EstimateOptions().depth;
+    // prompts are only shown for what the command line leaves out, and not at all with --folder
+    optional<string> folderArg, outputArg, fileDivisionsArg, folderDivisionsArg;
+    optional<StreamFormat> streamFormat;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if((arg == "-j" || arg == "--threads") && i + 1 < argc) {
             try {
-                fileSize = static_cast<unsigned long long>(entry.file_size());
-            }catch(const fs::filesystem_error& err) {
-                cerr << "\rerr file_size " << absolute(entry.path()) << ": " << err.what() << "\n\r" << flush;
+                threads = stoull(argv[++i]);
+                threadsGiven = true;
+            }catch(const logic_error& err) {
+                cerr << "Error invalid thread count: " << argv[i] << endl;
+                return 5;
             }
-            sizeWithFolders += fileSize;
-            sizeNoFolders += fileSize;
-
-            fileSizes.emplace_back(entry.path(), fileSize);
-
-            cout << "\rCalculating... " << fileSizes.size() << " files, " << folderSizes.size() << " directories " << flush;
-            if(entry.path().string().size() > longestPathName) {
-                longestPathName = entry.path().string().size();
+            if(threads == 0) {
+                cerr << "Error thread count must be at least 1" << endl;
+                return 5;
+            }
+        }else if(arg == "--backend" && i + 1 < argc) {
+            string name = argv[++i];
+            backendGiven = true;
+            if(name == "portable") {
+                backend = ScanBackend::Portable;
+            }else if(name == "native" && nativeBackendAvailable()) {
+                backend = ScanBackend::Native;
+            }else {
+                cerr << "Error unknown or unavailable backend: " << name << endl;
+                return 5;
+            }
+        }else if(arg == "--top" && i + 1 < argc) {
+            try {
+                rankLimit.top = stoull(argv[++i]);
+            }catch(const logic_error& err) {
+                cerr << "Error invalid --top count: " << argv[i] << endl;
+                return 5;
+            }
+        }else if(arg == "--min-size" && i + 1 < argc) {
+            try {
+                string sizeInput = argv[++i];
+                vector<unsigned long long> parsed;
+                parseDivisions(sizeInput, parsed);
+                if(parsed.size() != 1) throw invalid_argument("expected a single size '" + sizeInput + "'");
+                rankLimit.minSize = parsed[0];
+            }catch(const logic_error& err) {
+                cerr << "Error invalid --min-size: " << err.what() << endl;
+                return 5;
+            }
+        }else if(arg == "--memory-budget" && i + 1 < argc) {
+            try {
+                string sizeInput = argv[++i];
+                vector<unsigned long long> parsed;
+                parseDivisions(sizeInput, parsed);
+                if(parsed.size() != 1 || parsed[0] == 0) throw invalid_argument("expected a single size '" + sizeInput + "'");
+                memoryBudget = parsed[0];
+            }catch(const logic_error& err) {
+                cerr << "Error invalid --memory-budget: " << err.what() << endl;
+                return 5;
+            }
+        }else if(arg == "--temp-dir" && i + 1 < argc) {
+            tempDir = argv[++i];
+        }else if(arg == "--exclude" && i + 1 < argc) {
+            filter.exclude(argv[++i]);
+        }else if(arg == "--include" && i + 1 < argc) {
+            filter.include(argv[++i]);
+        }else if(arg == "--exclude-regex" && i + 1 < argc) {
+            if(!filter.excludeRegex(argv[++i])) return 5;
+        }else if(arg == "--include-regex" && i + 1 < argc) {
+            if(!filter.includeRegex(argv[++i])) return 5;
+        }else if(arg == "-x" || arg == "--one-file-system") {
+            filter.oneFileSystem();
+        }else if(arg == "--snapshot" && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        }else if(arg == "--folder" && i + 1 < argc) {
+            folderArg = argv[++i];
+        }else if(arg == "--output" && i + 1 < argc) {
+            outputArg = argv[++i];
+        }else if(arg == "--file-divisions" && i + 1 < argc) {
+            fileDivisionsArg = argv[++i];
+        }else if(arg == "--folder-divisions" && i + 1 < argc) {
+            folderDivisionsArg = argv[++i];
+        }else if(arg == "--stream" && i + 1 < argc) {
+            string name = argv[++i];
+            if(name == "ndjson") {
+                streamFormat = StreamFormat::Ndjson;
+            }else if(name == "csv") {
+                streamFormat = StreamFormat::Csv;
+            }else {
+                cerr << "Error unknown stream format: " << name << endl;
+                return 5;
+            }
+        }else if(arg == "--results" && i + 1 < argc) {
+            resultsPath = argv[++i];
+        }else if(arg == "--groups" && i + 1 < argc) {
+            groupsPath = argv[++i];
+        }else if(arg == "--group-by" && i + 1 < argc) {
+            try {
+                groupKeys = parseGroupKeys(argv[++i]);
+                groupKeysGiven = true;
+            }catch(const invalid_argument& err) {
+                cerr << "Error invalid --group-by: " << err.what() << endl;
+                return 5;
+            }
+        }else if(arg == "--dedupe" && i + 1 < argc) {
+            dedupePath = argv[++i];
+        }else if(arg == "--metrics") {
+            printMetrics = true;
+        }else if(arg == "--metrics-json" && i + 1 < argc) {
+            metricsJsonPath = argv[++i];
+        }else if(arg == "--watch" && i + 1 < argc) {
+            try {
+                watchSeconds = stoll(argv[++i]);
+            }catch(const logic_error& err) {
+                watchSeconds = 0;
             }
+            if(watchSeconds <= 0) {
+                cerr << "Error --watch needs a report interval in seconds: " << argv[i] << endl;
+                return 5;
+            }
+        }else if(arg == "--estimate" && i + 1 < argc) {
+            try {
+                estimateSeconds = stoll(argv[++i]);
+            }catch(const logic_error& err) {
+                estimateSeconds = 0;
+            }
+            if(estimateSeconds <= 0) {
+                cerr << "Error --estimate needs a time budget in seconds: " << argv[i] << endl;
+                return 5;
+            }
+        }else if(arg == "--estimate-depth" && i + 1 < argc) {
+            try {
+                estimateDepth = stoull(argv[++i]);
+            }catch(const logic_error& err) {
+                cerr << "Error invalid --estimate-depth: " << argv[i] << endl;
+                return 5;
+            }
+        }else {
+            cerr << "Error unknown argument: " << arg << endl;
+            cerr << "Usage: " << argv[0] << " [--folder DIR] [--output FILE] [--file-divisions SIZES] [--folder-divisions SIZES]"
+                 << " [-j|--threads N] [--backend native|portable] [--top N] [--min-size SIZE]"
+                 << " [--exclude GLOB] [--include GLOB] [--exclude-regex RE] [--include-regex RE] [-x|--one-file-system]"
+                 << " [--snapshot FILE] [--results FILE] [--watch SECONDS] [--stream ndjson|csv]"
+                 << " [--groups FILE [--group-by ext,owner,age]] [--dedupe FILE] [--memory-budget SIZE [--temp-dir DIR]]"
+                 << " [--estimate SECONDS [--estimate-depth N]] [--metrics] [--metrics-json FILE]" << endl;
+            cerr << "       " << argv[0] << " query RESULTS info|total|top|range|divisions ..." << endl;
+            cerr << "       " << argv[0] << " diff OLD NEW [--top N] [--divisions SIZES] [--min-size SIZE] [--output FILE]" << endl;
+            return 5;
         }
     }
-    folderSizes.emplace_back(path, sizeWithFolders);
-    folderSizesPure.emplace_back(path, sizeNoFolders);
-    cout << "\rCalculating... " << fileSizes.size() << " files, " << folderSizes.size() << " directories " << flush;
-    //Size representation
-    return sizeWithFolders;
-}
-void parseDivisions(string& input, vector<unsigned long long>& output) {
-    if(input.empty()) return;
-    transform(input.begin(), input.end(),
-              input.begin(), ::tolower);
 
-    // split by ','
-    size_t start = 0;
-    size_t delimiterPos; // delimiter is ','
-    while(true) {
-        bool breakAfterThis = false;
-        if((delimiterPos = input.find(',', start)) == string::npos) {
-            breakAfterThis = true;
-            delimiterPos = input.size(); // -1 for right
-        }
-        size_t left = start;
-        size_t right = delimiterPos - 1;
-//        size < 2
-//       right - left + 1 < 2
-//       right - left < 1
-        if(right - left < 1) {
-            // not enough size
-            throw invalid_argument("invalid division length '" + input.substr(left, delimiterPos-left) + "'");
-        }
-        // do something with left -> right
-        // check suffix
-        if(input[right] != 'b') { // has to be! GB,MB,KB,B
-            throw invalid_argument("invalid division suffix '" + input.substr(left, delimiterPos-left) + "'");
-        }
-
-        char secondLast = input[right-1];
-        unsigned long long multiplier;
-        if(secondLast == 'g') {
-            multiplier = GB_BYTES;
-            right -= 2;
-        }else if(secondLast == 'm') {
-            multiplier = MB_BYTES;
-            right -= 2;
-        }else if(secondLast == 'k') {
-            multiplier = KB_BYTES;
-            right -= 2;
-        }else {
-            // byte?
-            multiplier = 1;
-            right--;
-            if(!('0' <= input[right] && input[right] <= '9')) {
-                // not a Byte
-                throw invalid_argument("invalid division size type '" + input.substr(left, delimiterPos-left) + "'");
-            }
-        }
-        if(left > right) {
-            throw invalid_argument("invalid division length after suffix '" + input.substr(left, delimiterPos-left) + "'");
-        }
-        // convert substr left->right into ull
-        long double value = stold(input.substr(left,right+1-left));
-        long double bytes = value * multiplier;
-        if(bytes >= ULL_MAX) {
-            throw invalid_argument("division size above unsigned long long max '" + input.substr(left, delimiterPos-left) + "'");
+    bool interactive = !folderArg;
+    Metrics metrics;
+    // the library prints nothing itself: progress overwrites the current line, problems go to stderr
+    mutex messageLock;
+    MessageSink messages = [&messageLock](MessageLevel level, const string& message) {
+        lock_guard<mutex> guard(messageLock);
+        switch(level) {
+            case MessageLevel::Progress: cout << '\r' << message << ' ' << flush; break;
+            case MessageLevel::Info: cout << '\n' << message << endl; break;
+            default: cerr << '\r' << message << "\n\r"; break;
         }
-        output.push_back(static_cast<long long>(bytes));
-        start = delimiterPos+1;
-        if(breakAfterThis) break;
+    };
+    metrics.scan.messages = messages;
+    auto reportMetrics = [&]() {
+        metrics.stop();
+        if(printMetrics) metrics.printSummary(cerr);
+        return metricsJsonPath.empty() || metrics.writeJson(metricsJsonPath);
+    };
+    if(groupKeysGiven && groupsPath.empty()) {
+        cerr << "Error --group-by needs --groups FILE to write the tables to" << endl;
+        return 5;
     }
-}
-int main() {
-    cout << "Enter folder: ";
+    if(streamFormat && (rankLimit.top != RankLimit().top || !snapshotPath.empty() || !resultsPath.empty() || !dedupePath.empty()
+                        || !groupsPath.empty() || watchSeconds > 0)) {
+        cerr << "Error --stream keeps nothing to rank, it only goes with --min-size" << endl;
+        return 5;
+    }
+    if(streamFormat && (threadsGiven || backendGiven)) {
+        cerr << "Error --stream lists the folder serially in listing order, -j and --backend do not apply" << endl;
+        return 5;
+    }
+    if(memoryBudget > 0 && (streamFormat || !snapshotPath.empty() || !resultsPath.empty() || !dedupePath.empty() || watchSeconds > 0)) {
+        cerr << "Error --memory-budget keeps no tree, it does not go with --stream, --snapshot, --results, --dedupe or --watch" << endl;
+        return 5;
+    }
+    if(estimateSeconds > 0 && (streamFormat || !snapshotPath.empty() || !resultsPath.empty() || !dedupePath.empty()
+                               || !groupsPath.empty() || watchSeconds > 0 || memoryBudget > 0)) {
+        cerr << "Error --estimate samples the tree instead of scanning it, it only goes with the report options" << endl;
+        return 5;
+    }
+    auto ask = [interactive](const char* prompt, const optional<string>& given, string& value) {
+        if(given) {
+            value = *given;
+        }else if(interactive) {
+            cout << prompt << flush;
+            getline(cin, value);
+        }
+    };
     string sortedOutput, folderStr;
-    getline(cin, folderStr);
-    cout << "Output to: ";
-    getline(cin, sortedOutput);
+    ask("Enter folder: ", folderArg, folderStr);
+    ask("Output to: ", outputArg, sortedOutput);
 
     fs::path folderPath = folderStr;
     if(!fs::exists(folderPath)) {
@@ -168,22 +273,54 @@ int main() {
         cerr << "Error path is not a directory: " << folderStr << endl;
         return 2;
     }
+    if(!filter.prepare(folderPath)) {
+        return 5;
+    }
+    // rules are only looked at per entry when there are any
+    const ScanFilter* scanFilter = filter.empty() ? nullptr : &filter;
+    if(streamFormat) {
+        // "-" or nothing streams to stdout, progress and errors go to stderr
+        ofstream outputFile;
+        if(!sortedOutput.empty() && sortedOutput != "-") {
+            outputFile.open(sortedOutput, ios::binary);
+            if(!outputFile) {
+                cerr << "Error failed to create '" << sortedOutput << '\'' << endl;
+                return 6;
+            }
+        }
+        ostream& output = outputFile.is_open() ? outputFile : cout;
+        StreamWriter writer(output, *streamFormat, rankLimit.minSize);
+        metrics.start("scan");
+        streamCalc(folderPath, {
+            [&writer](const fs::path& path, unsigned long long size) { writer.file(path, size); },
+            [&writer](const fs::path& path, unsigned long long full, unsigned long long pure) { writer.dir(path, full, pure); }
+        }, metrics.scan, scanFilter);
+        writer.flush();
+        if(!output) {
+            cerr << "Error failed to write the stream" << endl;
+            return 6;
+        }
+        return reportMetrics() ? 0 : 6;
+    }
+    if(sortedOutput.empty() && !interactive) {
+        cerr << "Error --output is needed with --folder" << endl;
+        return 4;
+    }
     if(!fs::absolute(static_cast<fs::path>(sortedOutput)).has_parent_path()) {
         cerr << "Error sortedOutput has no directory: " << folderStr << endl;
         return 4;
     }
 
     unsigned long long fSize;
-    vector<pair<fs::path, unsigned long long>> fileSizes, folderSizes, folderSizesPure;
+    ScanTree tree(folderPath);
     vector<unsigned long long> fileDivisions, folderDivisions;
     {
         try {
             string divisionInput;
-            cout << "Write divisions for files (ex: '' for none, '10gb,1gb,500b' will >10GB,>1GB): " << flush;
-            getline(cin, divisionInput);
+            ask("Write divisions for files (ex: '' for none, '10gb,1gb,500b' will >10GB,>1GB): ", fileDivisionsArg, divisionInput);
             parseDivisions(divisionInput, fileDivisions);
-            cout << "Write divisions for folders: " << flush;
-            getline(cin, divisionInput);
+            divisionInput.clear();
+            ask("Write divisions for folders: ", folderDivisionsArg, divisionInput);
             parseDivisions(divisionInput, folderDivisions);
             sort(fileDivisions.begin(), fileDivisions.end(), greater<>());
             sort(folderDivisions.begin(), folderDivisions.end(), greater<>());
@@ -192,285 +329,211 @@ int main() {
             return 3;
         }
     }
-    size_t longestPathNameSizeT = 0;
-    {
-        cout << "Calculating files... \r" << flush;
-        fSize = recursiveCalc(fileSizes, folderSizes, folderSizesPure, longestPathNameSizeT, folderPath, folderPath);
+    if(estimateSeconds > 0) {
+        cout << "Estimating folders... \r" << flush;
+        metrics.start("estimate");
+        EstimateOptions options{estimateDepth, chrono::seconds(estimateSeconds), threads, scanFilter};
+        vector<EstimatedDir> estimated;
+        {
+            ProgressReporter progress(messages, metrics.scan, false);
+            estimated = estimateTree(folderPath, options, metrics.scan);
+        }
+        cout << "\nEstimated " << size_repr(estimated.front().estimate) << " +- " << size_repr(estimated.front().bound)
+             << " from " << metrics.scan.dirs.load() << " listed directories" << endl;
+        metrics.start("write");
+        if(!writeEstimateReport(estimated, options, rankLimit, folderDivisions, sortedOutput)) {
+            return 6;
+        }
+        if(!reportMetrics()) {
+            return 6;
+        }
+        cout << "\rDone" << endl;
+        if(interactive) {
+            cout << "\nFinished, press [ENTER] to exit!" << endl;
+            string a;
+            getline(cin, a);
+        }
+        return 0;
     }
-    longestPathNameSizeT += 20;
-    int longestPathName;
-    if(longestPathNameSizeT >= numeric_limits<int>::max()) {
-        cout << "Warning: longest path name used for sorting output (" << longestPathNameSizeT << ") is above int limit, so using int max ("
-            << numeric_limits<int>::max() << ")";
-        longestPathName = numeric_limits<int>::max();
-    }else {
-        longestPathName = static_cast<int>(longestPathNameSizeT);
+    // groups are counted by the scan itself and written once after it (also while watching)
+    unique_ptr<FileGroups> groups;
+    if(!groupsPath.empty()) {
+        groups = make_unique<FileGroups>(groupKeys, unixNanosNow());
+    }
+    auto writeGroups = [&]() {
+        if(!groups) return true;
+        metrics.start("groups");
+        cout << "\rWriting groups..." << flush;
+        return writeGroupReport(*groups, folderPath, folderDivisions, groupsPath);
+    };
+    if(memoryBudget > 0) {
+        cout << "Calculating files... \r" << flush;
+        if(!writeExternalReport(folderPath, rankLimit, fileDivisions, folderDivisions, sortedOutput,
+                                tempDir.empty() ? fs::temp_directory_path() : tempDir, memoryBudget, metrics, scanFilter,
+                                groups.get(), messages)) {
+            return 6;
+        }
+        if(!writeGroups()) {
+            return 6;
+        }
+        if(!reportMetrics()) {
+            return 6;
+        }
+        cout << "\rDone" << endl;
+        if(interactive) {
+            cout << "\nFinished, press [ENTER] to exit!" << endl;
+            string a;
+            getline(cin, a);
+        }
+        return 0;
     }
-    cout << "\nFinished calculating " << fileSizes.size() << " files, " << folderSizes.size() << " directories" << endl;
-    unsigned long long fileLine = 0, folderAllLine = 0, folderPureLine = 0;
-    vector<pair<int,int>> fileDivisionLines, folderAllDivisionLines, folderPureDivisionLines;
     {
+        // the previous snapshot lets unchanged directories skip listing, it is replaced after the scan
+        unique_ptr<ScanTree> previous;
+        if(!snapshotPath.empty() && fs::exists(snapshotPath)) {
+            previous = loadSnapshot(snapshotPath);
+            error_code ec;
+            if(previous && !fs::equivalent(previous->root, folderPath, ec)) {
+                cout << "Warning: snapshot is of " << previous->root << ", scanning everything" << endl;
+                previous.reset();
+            }else if(previous && previous->filterRules != filter.rules()) {
+                cout << "Warning: snapshot was taken with other --exclude/--include rules, scanning everything" << endl;
+                previous.reset();
+            }
+        }
+        cout << "Calculating files... \r" << flush;
+        metrics.start("scan");
+        ProgressReporter progress(messages, metrics.scan, previous != nullptr);
+        if(threads > 1 || backend != ScanBackend::Portable || previous) {
+            fSize = parallelCalc(tree, threads, backend, metrics.scan, previous.get(), scanFilter, groups.get());
+        }else {
+            fSize = recursiveCalc(tree, metrics.scan, scanFilter, groups.get());
+        }
+    }
+    metrics.stop();
+    cout << "\nFinished calculating " << tree.fileCount() << " files, " << tree.dirCount() << " directories" << endl;
+    auto writeRankedReport = [&](unsigned long long totalSize, const TreeWatcher* watcher) {
+        size_t longestPathNameSizeT = tree.longestPathName + 20;
+        int longestPathName;
+        if(longestPathNameSizeT >= numeric_limits<int>::max()) {
+            cout << "Warning: longest path name used for sorting output (" << longestPathNameSizeT << ") is above int limit, so using int max ("
+                << numeric_limits<int>::max() << ")";
+            longestPathName = numeric_limits<int>::max();
+        }else {
+            longestPathName = static_cast<int>(longestPathNameSizeT);
+        }
+        // rankings are index arrays into the tree, biggest to smallest. While watching, removed
+        // entries are still in the columns and are left out before the limit.
+        auto rankEntries = [&](const vector<unsigned long long>& sizes, const vector<uint32_t>& parents) {
+            return watcher ? rankBySize(sizes, rankLimit, threads, parents, TreeWatcher::REMOVED_DIR)
+                           : rankBySize(sizes, rankLimit, threads);
+        };
+        metrics.start("sort");
         cout << "\nSorting fileSizes..." << flush;
-        sort(fileSizes.begin(), fileSizes.end(),
-             [](pair<fs::path, unsigned long long>& a, pair<fs::path, unsigned long long>& b) -> bool {
-            return a.second > b.second; // Reverse order biggest to smallest
-        });
+        vector<uint32_t> fileOrder = rankEntries(tree.fileSize, tree.fileParent);
         cout << "\nSorting folderSizes..." << flush;
-        sort(folderSizes.begin(), folderSizes.end(),
-             [](pair<fs::path, unsigned long long>& a, pair<fs::path, unsigned long long>& b) -> bool {
-                 return a.second > b.second; // Reverse order biggest to smallest
-             });
+        vector<uint32_t> folderOrder = rankEntries(tree.dirFull, tree.dirParent);
         cout << "\nSorting folderSizesPure..." << flush;
-        sort(folderSizesPure.begin(), folderSizesPure.end(),
-             [](pair<fs::path, unsigned long long>& a, pair<fs::path, unsigned long long>& b) -> bool {
-                 return a.second > b.second; // Reverse order biggest to smallest
-             });
+        vector<uint32_t> folderPureOrder = rankEntries(tree.dirPure, tree.dirParent);
         // Sorted
 
+        metrics.start("write");
         cout << "\nWriting... " << flush;
-        ofstream sortedOut(fs::absolute(sortedOutput));
-        // Sorted Output X
-        //
-        // Files: Line X
-        // Folders S: Line X
-        // Folders Y : line x
-        //
-        // ==FILES START==
-        int lineCount = 1;
-        sortedOut << "Sorted Output " << fs::absolute(folderPath) << " [" << size_repr(fSize) << "]\n\n"; lineCount += 2;
-//        sortedOut << "Files: Line X\n"; lineCount++;
-//        sortedOut << "Folders sort on all: Line X\n"; lineCount ++;
-//        sortedOut << "Folders sort on pure: Line X\n\n"; lineCount += 2; // this will be updated later along with divisions
-        sortedOut << '#';
-        lineCount++;
-        lineCount++;
-        lineCount += 2;
-        sortedOut << '\n'; lineCount++;
-        cout << "\rWriting... files... " << flush;
-        { // Files
-            sortedOut << "==== FILES START====\n";
-            fileLine = lineCount;
-            lineCount++;
-            int totalRankDigits = static_cast<int>(ceil(log10(fileSizes.size()))) + 3;
-            // +3 for '. ' and 1 more for error
-            sortedOut << setw(totalRankDigits) << left << "Rank";
-            sortedOut << setw(longestPathName) << left << "File";
-            sortedOut << setw(20) << left << "Size";
-            sortedOut << '\n'; lineCount++;
-            size_t currentIndex = 0;
-            size_t filesCount = fileSizes.size();
-            for(unsigned long long division : fileDivisions) {
-                sortedOut << "Marker Start " << size_repr(division) << '\n';
-                int divisionLineStart = lineCount;
-                lineCount++;
-                // Go through all files that match
-                while(currentIndex < filesCount) {
-                    if(fileSizes[currentIndex].second >= division) {
-                        sortedOut << setw(totalRankDigits) << left << (to_string(currentIndex+1) + ". ");
-                        sortedOut << setw(longestPathName) << left << ("\'" + fileSizes[currentIndex].first.string() + "\'");
-                        sortedOut << setw(20) << left << (size_repr(fileSizes[currentIndex].second));
-                        sortedOut << '\n'; lineCount++;
-                        currentIndex++;
-                    }else break;
-                }
-                sortedOut << "Marker End " << size_repr(division) << '\n';
-                int divisionLineEnd = lineCount;
-                lineCount++;
-                fileDivisionLines.emplace_back(divisionLineStart, divisionLineEnd);
-            }
-            // go through the rest of files
-            while(currentIndex < filesCount) {
-                sortedOut << setw(totalRankDigits) << left << (to_string(currentIndex+1) + ". ");
-                sortedOut << setw(longestPathName) << left << ("\'" + fileSizes[currentIndex].first.string() + "\'");
-                sortedOut << setw(20) << left << (size_repr(fileSizes[currentIndex].second));
-                sortedOut << '\n'; lineCount++;
-                currentIndex++;
-            }
+        Report report{tree, totalSize, fileOrder, folderOrder, folderPureOrder, fileDivisions, folderDivisions, longestPathName};
+        if(!writeReport(report, sortedOutput, messages)) return false;
+        if(resultsPath.empty()) return true;
+        metrics.start("index");
+        return writeResults(report, resultsPath);
+    };
+    if(!writeRankedReport(fSize, nullptr)) {
+        return 6;
+    }
+    if(!dedupePath.empty()) {
+        cout << "\rFinding duplicates..." << flush;
+        metrics.start("dedupe");
+        DedupeStats dedupeStats;
+        dedupeStats.messages = messages;
+        vector<DuplicateGroup> duplicates = findDuplicates(tree, threads, dedupeStats);
+        if(!writeDuplicateReport(tree, duplicates, dedupeStats, dedupePath)) {
+            return 6;
         }
-        cout << "\rWriting... folders full..." << flush;
-        { // Folders all
-            sortedOut << '\n'; lineCount++;
-            sortedOut << "==== FOLDERS FULL START ====\n";
-            folderAllLine = lineCount;
-            lineCount++;
-
-            int totalRankDigits = static_cast<int>(ceil(log10(folderSizes.size()))) + 3;
-            sortedOut << setw(totalRankDigits) << left << "Rank";
-            sortedOut << setw(longestPathName) << left << "Folder";
-            sortedOut << setw(20) << left << "Size (Full)";
-            sortedOut << setw(20) << left << "Size (Pure)";
-            sortedOut << '\n'; lineCount++;
-
-            unordered_map<fs::path, unsigned long long> pureSizesMap;
-            pureSizesMap.reserve(folderSizesPure.size());
-            for(auto& pair : folderSizesPure) {
-                pureSizesMap.insert(pair);
-            }
-
-            size_t currentIndex = 0;
-            size_t foldersCount = folderSizes.size();
-            for(unsigned long long division : folderDivisions) {
-                sortedOut << "Marker Start " << size_repr(division) << '\n';
-                int divisionLineStart = lineCount;
-                lineCount++;
-                // Go through all files that match
-                while(currentIndex < foldersCount) {
-                    if(folderSizes[currentIndex].second >= division) {
-                        sortedOut << setw(totalRankDigits) << left << (to_string(currentIndex+1) + ". ");
-                        sortedOut << setw(longestPathName) << left << ("\'" + folderSizes[currentIndex].first.string() + "\'");
-                        sortedOut << setw(20) << left << (size_repr(folderSizes[currentIndex].second));
-                        sortedOut << setw(20) << left << (size_repr(pureSizesMap[folderSizes[currentIndex].first]));
-                        sortedOut << '\n'; lineCount++;
-                        currentIndex++;
-                    }else break;
+        unsigned long long reclaimable = 0;
+        for(const DuplicateGroup& group : duplicates) reclaimable += group.reclaimable;
+        cout << "\rDuplicates: " << duplicates.size() << " groups, " << size_repr(reclaimable) << " reclaimable (read "
+             << size_repr(dedupeStats.bytesRead) << ")" << endl;
+    }
+    if(!writeGroups()) {
+        return 6;
+    }
+    metrics.stop();
+    if(watchSeconds > 0) {
+        TreeWatcher watcher(tree, threads, backend, scanFilter, messages);
+        if(!watcher.start()) {
+            return 8;
+        }
+        cout << "\rWatching for changes, the report is rewritten every " << watchSeconds << " s while things change.\n"
+             << "[ENTER] rewrites it now, q + [ENTER] stops." << endl;
+        auto interval = chrono::seconds(watchSeconds);
+        auto nextWrite = chrono::steady_clock::now() + interval;
+        while(true) {
+            auto left = chrono::duration_cast<chrono::milliseconds>(nextWrite - chrono::steady_clock::now());
+            WatchWake wake = watcher.wait(static_cast<int>(max(0ll, static_cast<long long>(left.count()))));
+            if(wake == WatchWake::Stop) break;
+            bool writeNow = false;
+            if(wake == WatchWake::Input) {
+                string line;
+                if(!getline(cin, line)) {
+                    watcher.ignoreInput();
+                }else if(line == "q") {
+                    break;
+                }else {
+                    writeNow = true;
                 }
-                sortedOut << "Marker End " << size_repr(division) << '\n';
-                int divisionLineEnd = lineCount;
-                lineCount++;
-                folderAllDivisionLines.emplace_back(divisionLineStart, divisionLineEnd);
-            }
-            // go through the rest of folders
-            while(currentIndex < foldersCount) {
-                sortedOut << setw(totalRankDigits) << left << (to_string(currentIndex+1) + ". ");
-                sortedOut << setw(longestPathName) << left << ("\'" + folderSizes[currentIndex].first.string() + "\'");
-                sortedOut << setw(20) << left << (size_repr(folderSizes[currentIndex].second));
-                sortedOut << setw(20) << left << (size_repr(pureSizesMap[folderSizes[currentIndex].first]));
-                sortedOut << '\n'; lineCount++;
-                currentIndex++;
             }
-        }
-        cout << "\rWriting... folders pure..." << flush;
-        { // Folders pure
-            sortedOut << '\n'; lineCount++;
-            sortedOut << "==== FOLDERS PURE START ====\n";
-            folderPureLine = lineCount;
-            lineCount++;
-
-            int totalRankDigits = static_cast<int>(ceil(log10(folderSizesPure.size()))) + 3;
-            sortedOut << setw(totalRankDigits) << left << "Rank";
-            sortedOut << setw(longestPathName) << left << "Folder";
-            sortedOut << setw(20) << left << "Size (Full)";
-            sortedOut << setw(20) << left << "Size (Pure)";
-            sortedOut << '\n'; lineCount++;
-
-            unordered_map<fs::path, unsigned long long> allSizesMap;
-            allSizesMap.reserve(folderSizes.size());
-            for(auto& pair : folderSizes) {
-                allSizesMap.insert(pair);
+            if(chrono::steady_clock::now() >= nextWrite) {
+                nextWrite = chrono::steady_clock::now() + interval;
+                writeNow = writeNow || watcher.takeChanged();
             }
-
-            size_t currentIndex = 0;
-            size_t foldersCount = folderSizesPure.size();
-            for(unsigned long long division : folderDivisions) {
-                sortedOut << "Marker Start " << size_repr(division) << '\n';
-                int divisionLineStart = lineCount;
-                lineCount++;
-                // Go through all files that match
-                while(currentIndex < foldersCount) {
-                    if(folderSizesPure[currentIndex].second >= division) {
-                        sortedOut << setw(totalRankDigits) << left << (to_string(currentIndex+1) + ". ");
-                        sortedOut << setw(longestPathName) << left << ("\'" + folderSizesPure[currentIndex].first.string() + "\'");
-                        sortedOut << setw(20) << left << (size_repr(allSizesMap[folderSizesPure[currentIndex].first]));
-                        sortedOut << setw(20) << left << (size_repr(folderSizesPure[currentIndex].second));
-                        sortedOut << '\n'; lineCount++;
-                        currentIndex++;
-                    }else break;
+            if(writeNow) {
+                watcher.takeChanged();
+                // results files hold every entry of the tree, removed ones have to be gone first
+                if(!resultsPath.empty()) watcher.compact();
+                if(!writeRankedReport(watcher.totalSize(), &watcher)) {
+                    return 6;
                 }
-                sortedOut << "Marker End " << size_repr(division) << '\n';
-                int divisionLineEnd = lineCount;
-                lineCount++;
-                folderPureDivisionLines.emplace_back(divisionLineStart, divisionLineEnd);
+                metrics.stop();
+                cout << "\rReport updated: " << watcher.fileCount() << " files, " << size_repr(watcher.totalSize()) << endl;
             }
-            // go through the rest of folders
-            while(currentIndex < foldersCount) {
-                sortedOut << setw(totalRankDigits) << left << (to_string(currentIndex+1) + ". ");
-                sortedOut << setw(longestPathName) << left << ("\'" + folderSizesPure[currentIndex].first.string() + "\'");
-                sortedOut << setw(20) << left << (size_repr(allSizesMap[folderSizesPure[currentIndex].first]));
-                sortedOut << setw(20) << left << (size_repr(folderSizesPure[currentIndex].second));
-                sortedOut << '\n'; lineCount++;
-                currentIndex++;
-            }
-        }
-        cout << "\rWriting... markers and lines..." << endl;
-        sortedOut << flush;
-    }
-    {
-        // Edit
-        stringstream lineContent;
-
-        lineContent << "Files: L" << fileLine << " | ";
-        for(size_t i = 0; i < fileDivisions.size(); i++) {
-            pair<int,int>& startEnd = fileDivisionLines[i];
-            lineContent << size_repr(fileDivisions[i]) <<
-                    ": L" << startEnd.first << " - L" << startEnd.second << " | ";
-        }
-        char n = 10;
-        lineContent.write(&n, 1);
-        lineContent << "Folders fullsort: L" << folderAllLine << " | ";
-        for(size_t i = 0; i < folderDivisions.size(); i++) {
-            pair<int,int>& startEnd = folderAllDivisionLines[i];
-            lineContent << size_repr(folderDivisions[i]) <<
-                        ": L" << startEnd.first << " - L" << startEnd.second << " | ";
         }
-        lineContent << '\n';
-        lineContent << "Folders puresort: L" << folderPureLine << " | ";
-        for(size_t i = 0; i < folderDivisions.size(); i++) {
-            pair<int,int>& startEnd = folderPureDivisionLines[i];
-            lineContent << size_repr(folderDivisions[i]) <<
-                        ": L" << startEnd.first << " - L" << startEnd.second << " | ";
+        if(watcher.rootRemoved()) {
+            cerr << "\nError folder was removed: " << folderStr << endl;
+            return 1;
         }
-        lineContent << "\n\n";
-        string replacement = lineContent.str();
-
-        // replace
-        fs::path sortedOutputPath = fs::absolute(sortedOutput);
-
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<long long> dist(1ll, 600000000000000ll);
-        fs::path tempFile(sortedOutputPath.parent_path());
-        tempFile /= "test.txt";
-        do {
-            tempFile = tempFile.parent_path();
-            tempFile /= ("~fsc-temps-" + to_string(dist(gen)+2) + to_string(dist(gen)));
-        }while(fs::exists(tempFile));
-
-        {
-            ofstream tempStream(tempFile);
-            ifstream in(sortedOutputPath);
-            char read;
-            while(true) {
-                in.read(&read, 1);
-                if(read == -1 || read == '#') {
-                    break;
-                }
-                tempStream << read;
-            }
-            if(read == -1) {
-                // ????
-                tempStream.close();
-                if(!fs::remove(tempFile)) {
-                    cerr << "\nWarning: failed to remove tempFile '" << tempFile << '\'' << endl;
-                }
-            }else {
-                // '#' lets gooo
-                tempStream << replacement;
-                // pipe everything else
-                char buffer[1024];
-                while(in.read(buffer, 1024)) {
-                    tempStream.write(buffer, in.gcount());
-                }
-                // succcees!
-                tempStream.close();
-                in.close();
-                if(!fs::remove(sortedOutputPath)) {
-                    cerr << "\nWarning: failed to remove original sorted file '" << sortedOutputPath << '\'' << endl;
-                    cerr << "\nYou can view the full sorted output in '" << tempFile << '\'' << endl;
-                }else {
-                    fs::rename(tempFile, sortedOutputPath);
-                }
+        // the snapshot below needs the directories in post-order again
+        watcher.compact();
+        if(!snapshotPath.empty()) {
+            cout << "\rSaving snapshot..." << flush;
+            metrics.start("snapshot");
+            if(!saveSnapshot(tree, snapshotPath)) {
+                return 7;
             }
         }
+        cout << "\rDone" << endl;
+        return reportMetrics() ? 0 : 6;
+    }
+    if(!snapshotPath.empty()) {
+        cout << "\rSaving snapshot..." << flush;
+        metrics.start("snapshot");
+        if(!saveSnapshot(tree, snapshotPath)) {
+            return 7;
+        }
+    }
+    if(!reportMetrics()) {
+        return 6;
+    }
+    if(!interactive) {
+        cout << "\rDone" << endl;
+        return 0;
     }
     cout << "\rDone\n\nFinished, press [ENTER] to exit!" << endl;
     string a;
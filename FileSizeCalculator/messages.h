@@ -0,0 +1,23 @@
+#ifndef FILESIZECALCULATOR_MESSAGES_H
+#define FILESIZECALCULATOR_MESSAGES_H
+
+#include <functional>
+#include <string>
+
+enum class MessageLevel {
+    Progress, // what is being worked on, the next one replaces it
+    Info,     // a line of its own, like the counts once a scan finished
+    Warning,  // the work goes on, but not everything is seen
+    Error     // an entry could not be read or a step failed
+};
+
+// How the scanning library tells its caller what it is doing, it never writes to the terminal
+// itself. Messages have no line end. Scans call it from their worker threads, possibly several
+// at once. Left empty, messages are dropped.
+using MessageSink = std::function<void(MessageLevel level, const std::string& message)>;
+
+inline void sendMessage(const MessageSink& messages, MessageLevel level, const std::string& message) {
+    if(messages) messages(level, message);
+}
+
+#endif //FILESIZECALCULATOR_MESSAGES_H
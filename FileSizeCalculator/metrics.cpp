@@ -0,0 +1,123 @@
+#include "metrics.h"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "format.h"
+#include "output.h"
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+ProgressReporter::ProgressReporter(MessageSink messages, const ScanStats& stats, bool showReused,
+                                   chrono::milliseconds interval)
+        : messages(std::move(messages)), stats(stats), showReused(showReused), interval(interval) {
+    printer = thread([this] {
+        unique_lock<mutex> guard(lock);
+        while(!wake.wait_for(guard, this->interval, [this] { return stopping; })) {
+            print();
+        }
+    });
+}
+
+ProgressReporter::~ProgressReporter() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    printer.join();
+    print();
+}
+
+void ProgressReporter::print() {
+    if(!messages) return;
+    ostringstream out;
+    out << "Calculating... " << stats.files << " files, " << stats.dirs << " directories";
+    if(showReused) out << " (" << stats.reusedDirs << " unchanged)";
+    messages(MessageLevel::Progress, out.str());
+}
+
+Metrics::Metrics() : created(chrono::steady_clock::now()) {}
+
+void Metrics::start(const string& name) {
+    stop();
+    for(Phase& phase : phases) {
+        if(phase.name == name) running = &phase;
+    }
+    if(!running) {
+        phases.push_back({name});
+        running = &phases.back();
+    }
+    runningSince = chrono::steady_clock::now();
+}
+
+void Metrics::stop() {
+    if(!running) return;
+    running->time += chrono::steady_clock::now() - runningSince;
+    running = nullptr;
+}
+
+double Metrics::seconds(const string& name) const {
+    for(const Phase& phase : phases) {
+        if(phase.name == name) return chrono::duration<double>(phase.time).count();
+    }
+    return 0;
+}
+
+double Metrics::totalSeconds() const {
+    return chrono::duration<double>(chrono::steady_clock::now() - created).count();
+}
+
+void Metrics::printSummary(ostream& out) const {
+    double scanSeconds = seconds("scan");
+    unsigned long long entries = scan.files + scan.dirs;
+    out << "\nMetrics:\n" << fixed << setprecision(3);
+    for(const Phase& phase : phases) {
+        out << "  " << left << setw(10) << phase.name << chrono::duration<double>(phase.time).count() << " s\n";
+    }
+    out << "  " << setw(10) << "total" << totalSeconds() << " s\n"
+        << "  " << setw(10) << "entries" << scan.files << " files, " << scan.dirs << " directories";
+    if(scan.reusedDirs > 0) out << " (" << scan.reusedDirs << " unchanged)";
+    if(scan.skipped > 0) out << ", " << scan.skipped << " left out";
+    if(scanSeconds > 0) out << ", " << setprecision(0) << entries / scanSeconds << " /s" << setprecision(3);
+    out << "\n  " << setw(10) << "syscalls" << scan.dirOpens << " directory opens, " << scan.dirReads
+        << " directory reads, " << scan.stats << " stats\n"
+        << "  " << setw(10) << "errors" << scan.errors << '\n'
+        << "  " << setw(10) << "peak RSS" << size_repr(peakRssBytes()) << endl;
+    out << defaultfloat << right;
+}
+
+bool Metrics::writeJson(const fs::path& path) const {
+    ostringstream json;
+    double scanSeconds = seconds("scan");
+    json << fixed << setprecision(6) << "{\"phases\":{";
+    for(size_t i = 0; i < phases.size(); i++) {
+        if(i > 0) json << ',';
+        json << '"' << phases[i].name << "\":" << chrono::duration<double>(phases[i].time).count();
+    }
+    json << "},\"total_seconds\":" << totalSeconds()
+         << ",\"files\":" << scan.files << ",\"dirs\":" << scan.dirs << ",\"reused_dirs\":" << scan.reusedDirs
+         << ",\"skipped\":" << scan.skipped
+         << ",\"entries_per_second\":" << (scanSeconds > 0 ? (scan.files + scan.dirs) / scanSeconds : 0.0)
+         << ",\"syscalls\":{\"dir_opens\":" << scan.dirOpens << ",\"dir_reads\":" << scan.dirReads
+         << ",\"stats\":" << scan.stats << "},\"errors\":" << scan.errors
+         << ",\"peak_rss_bytes\":" << peakRssBytes() << "}\n";
+    string text = json.str();
+    return writeFileAtomically(path, [&text](ostream& out) { out.write(text.data(), static_cast<streamsize>(text.size())); });
+}
+
+unsigned long long peakRssBytes() {
+#ifdef __unix__
+    rusage usage{};
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        return static_cast<unsigned long long>(usage.ru_maxrss) * 1024; // kilobytes on Linux and the BSDs
+    }
+#endif
+    return 0;
+}
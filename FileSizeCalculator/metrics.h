@@ -0,0 +1,70 @@
+#ifndef FILESIZECALCULATOR_METRICS_H
+#define FILESIZECALCULATOR_METRICS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "scan.h"
+
+// Sends "Calculating... N files, M directories" as MessageLevel::Progress from its own thread
+// every `interval` while it exists, the scan itself only reports errors. The final counts are
+// sent once more when it is destroyed.
+class ProgressReporter {
+public:
+    ProgressReporter(MessageSink messages, const ScanStats& stats, bool showReused = false,
+                     std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    ~ProgressReporter();
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+private:
+    MessageSink messages;
+    const ScanStats& stats;
+    bool showReused;
+    std::chrono::milliseconds interval;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread printer;
+
+    void print();
+};
+
+// Wall time per phase and the scan's counters for one run. A phase that is started again
+// (every report rewrite while watching) adds to its time.
+class Metrics {
+public:
+    ScanStats scan;
+
+    Metrics();
+    // Ends the running phase, if any, and starts `name`
+    void start(const std::string& name);
+    void stop();
+
+    void printSummary(std::ostream& out) const;
+    // Returns false (after printing why) if it could not be written
+    bool writeJson(const std::filesystem::path& path) const;
+
+private:
+    struct Phase {
+        std::string name;
+        std::chrono::steady_clock::duration time{};
+    };
+    std::vector<Phase> phases; // in the order they first ran
+    Phase* running = nullptr;
+    std::chrono::steady_clock::time_point created, runningSince;
+
+    double seconds(const std::string& name) const;
+    double totalSeconds() const;
+};
+
+// Largest resident set size of the process so far, 0 where it is not known
+unsigned long long peakRssBytes();
+
+#endif //FILESIZECALCULATOR_METRICS_H
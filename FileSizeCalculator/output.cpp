@@ -0,0 +1,48 @@
+#include "output.h"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <system_error>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+bool writeFileAtomically(const fs::path& path, const function<void(ostream&)>& write, ios::openmode mode) {
+    fs::path outputPath = fs::absolute(path);
+
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<long long> dist(1ll, 600000000000000ll);
+    fs::path tempFile;
+    do {
+        tempFile = outputPath.parent_path() / ("~fsc-temps-" + to_string(dist(gen)+2) + to_string(dist(gen)));
+    }while(fs::exists(tempFile));
+
+    {
+        ofstream out;
+        out.rdbuf()->pubsetbuf(nullptr, 0);
+        out.open(tempFile, mode | ios::out);
+        if(!out) {
+            cerr << "\nError failed to create '" << tempFile.string() << '\'' << endl;
+            return false;
+        }
+        write(out);
+        out.close();
+        if(out.fail()) {
+            cerr << "\nError failed to write '" << tempFile.string() << '\'' << endl;
+            error_code ec;
+            fs::remove(tempFile, ec);
+            return false;
+        }
+    }
+    error_code ec;
+    fs::rename(tempFile, outputPath, ec);
+    if(ec) {
+        cerr << "\nError failed to rename '" << tempFile.string() << "' to '" << outputPath.string() << "': " << ec.message() << endl;
+        cerr << "\nYou can view the full output in '" << tempFile << '\'' << endl;
+        return false;
+    }
+    return true;
+}
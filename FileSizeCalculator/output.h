@@ -0,0 +1,15 @@
+#ifndef FILESIZECALCULATOR_OUTPUT_H
+#define FILESIZECALCULATOR_OUTPUT_H
+
+#include <filesystem>
+#include <functional>
+#include <ios>
+#include <ostream>
+
+// Writes `path` through `write` under a temporary name in the same directory and renames it
+// over `path` once complete, so an existing file is never left half written. The stream is
+// unbuffered, write in large blocks. Returns false (after printing why) if it failed.
+bool writeFileAtomically(const std::filesystem::path& path, const std::function<void(std::ostream&)>& write,
+                         std::ios::openmode mode = std::ios::out);
+
+#endif //FILESIZECALCULATOR_OUTPUT_H
@@ -0,0 +1,166 @@
+#include "query.h"
+
+#include <algorithm>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "format.h"
+#include "results.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// One of the three rankings and the columns it was ranked by
+struct Ranking {
+    bool folders;
+    span<const uint32_t> order;
+    span<const uint64_t> sizes;
+    span<const uint64_t> divisions;
+    span<const uint64_t> divisionEnds;
+};
+
+static bool selectRanking(const ResultFile& results, const string& name, Ranking& ranking) {
+    if(name == "files") {
+        ranking = {false, results.section<uint32_t>(FileOrder), results.section<uint64_t>(FileSize),
+                   results.section<uint64_t>(FileDivisions), results.section<uint64_t>(FileDivisionEnds)};
+    }else if(name == "folders") {
+        ranking = {true, results.section<uint32_t>(FolderOrder), results.section<uint64_t>(DirFull),
+                   results.section<uint64_t>(FolderDivisions), results.section<uint64_t>(FolderDivisionEnds)};
+    }else if(name == "pure") {
+        ranking = {true, results.section<uint32_t>(FolderPureOrder), results.section<uint64_t>(DirPure),
+                   results.section<uint64_t>(FolderDivisions), results.section<uint64_t>(FolderPureDivisionEnds)};
+    }else {
+        cerr << "Error unknown ranking '" << name << "', expected files, folders or pure" << endl;
+        return false;
+    }
+    return true;
+}
+
+static void printRows(const ResultFile& results, const Ranking& ranking, size_t first, size_t last) {
+    auto dirFull = results.section<uint64_t>(DirFull);
+    auto dirPure = results.section<uint64_t>(DirPure);
+    last = min(last, ranking.order.size());
+    for(size_t rank = first; rank < last; rank++) {
+        uint32_t index = ranking.order[rank];
+        if(index >= ranking.sizes.size()) {
+            cerr << "Error corrupt ranking entry " << rank + 1 << endl;
+            return;
+        }
+        cout << rank + 1 << ". '" << (ranking.folders ? results.dirPath(index) : results.filePath(index)) << "' ";
+        if(ranking.folders) {
+            cout << size_repr(dirFull[index]) << " (pure " << size_repr(dirPure[index]) << ")\n";
+        }else {
+            cout << size_repr(ranking.sizes[index]) << '\n';
+        }
+    }
+    cout << flush;
+}
+
+// End of the ranked entries at least `size` big, a stored division end when size is one
+static size_t rankedAtLeast(const Ranking& ranking, unsigned long long size) {
+    for(size_t i = 0; i < ranking.divisions.size(); i++) {
+        if(ranking.divisions[i] == size) return min<size_t>(ranking.divisionEnds[i], ranking.order.size());
+    }
+    auto end = partition_point(ranking.order.begin(), ranking.order.end(), [&](uint32_t index) {
+        return index < ranking.sizes.size() && ranking.sizes[index] >= size;
+    });
+    return static_cast<size_t>(end - ranking.order.begin());
+}
+
+static bool parseSize(string text, unsigned long long& size) {
+    vector<unsigned long long> parsed;
+    try {
+        parseDivisions(text, parsed);
+    }catch(const logic_error& err) {
+        cerr << "Error invalid size: " << err.what() << endl;
+        return false;
+    }
+    if(parsed.size() != 1) {
+        cerr << "Error expected a single size: " << text << endl;
+        return false;
+    }
+    size = parsed[0];
+    return true;
+}
+
+int runQuery(int argc, char* argv[]) {
+    if(argc < 3) {
+        cerr << "Usage: query RESULTS info | total PATH | top files|folders|pure [N]"
+             << " | range files|folders|pure MIN [MAX] | divisions files|folders|pure" << endl;
+        return 5;
+    }
+    ResultFile results;
+    if(!results.open(argv[1])) {
+        return 9;
+    }
+    string command = argv[2];
+    if(command == "info") {
+        cout << "Root: " << results.dirPath(results.rootDir()) << '\n'
+             << "Total: " << size_repr(results.totalSize()) << '\n'
+             << "Files: " << results.fileCount() << " (" << results.section<uint32_t>(FileOrder).size() << " ranked)\n"
+             << "Folders: " << results.dirCount() << " (" << results.section<uint32_t>(FolderOrder).size() << " ranked)" << endl;
+        return 0;
+    }
+    if(command == "total" && argc == 4) {
+        uint32_t dir = results.findDir(argv[3]);
+        if(dir != NO_DIR) {
+            cout << "'" << results.dirPath(dir) << "' " << size_repr(results.section<uint64_t>(DirFull)[dir])
+                 << " (pure " << size_repr(results.section<uint64_t>(DirPure)[dir]) << ")" << endl;
+            return 0;
+        }
+        uint32_t file = results.findFile(argv[3]);
+        if(file != NO_DIR) {
+            cout << "'" << results.filePath(file) << "' " << size_repr(results.section<uint64_t>(FileSize)[file]) << endl;
+            return 0;
+        }
+        cerr << "Error not in the results: " << argv[3] << endl;
+        return 1;
+    }
+    Ranking ranking{};
+    if(argc < 4 || !selectRanking(results, argv[3], ranking)) {
+        if(argc < 4) cerr << "Error unknown query: " << command << endl;
+        return 5;
+    }
+    if(command == "top" && argc <= 5) {
+        size_t count = 10;
+        if(argc == 5) {
+            try {
+                count = stoull(argv[4]);
+            }catch(const logic_error& err) {
+                cerr << "Error invalid count: " << argv[4] << endl;
+                return 5;
+            }
+        }
+        printRows(results, ranking, 0, count);
+        return 0;
+    }
+    if(command == "range" && (argc == 5 || argc == 6)) {
+        unsigned long long minSize, maxSize;
+        if(!parseSize(argv[4], minSize) || (argc == 6 && !parseSize(argv[5], maxSize))) {
+            return 5;
+        }
+        size_t first = argc == 6 ? rankedAtLeast(ranking, maxSize) : 0;
+        printRows(results, ranking, first, rankedAtLeast(ranking, minSize));
+        return 0;
+    }
+    if(command == "divisions" && argc == 4) {
+        size_t start = 0;
+        for(size_t i = 0; i < ranking.divisions.size(); i++) {
+            size_t end = min<size_t>(ranking.divisionEnds[i], ranking.order.size());
+            cout << ">= " << size_repr(ranking.divisions[i]) << ": ";
+            if(end > start) {
+                cout << "ranks " << start + 1 << " - " << end << '\n';
+            }else {
+                cout << "none\n";
+            }
+            start = max(start, end);
+        }
+        cout << "rest: " << ranking.order.size() - start << " entries" << endl;
+        return 0;
+    }
+    cerr << "Error unknown query: " << command << endl;
+    return 5;
+}
@@ -0,0 +1,14 @@
+#ifndef FILESIZECALCULATOR_QUERY_H
+#define FILESIZECALCULATOR_QUERY_H
+
+// `FileSizeCalculator query RESULTS COMMAND ...` answers from a results file (see results.h)
+// without scanning or reading more of it than the answer needs:
+//   info                                  root, totals and what was ranked
+//   total PATH                            full and pure size of a folder, or a file's size
+//   top files|folders|pure [N]            the N biggest entries of a ranking (default 10)
+//   range files|folders|pure MIN [MAX]    ranked entries with MIN <= size < MAX
+//   divisions files|folders|pure          the report's divisions and which ranks they hold
+// argv[0] is "query". Returns the process exit code.
+int runQuery(int argc, char* argv[]);
+
+#endif //FILESIZECALCULATOR_QUERY_H
@@ -0,0 +1,137 @@
+#include "rank.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+// Below this many entries a parallel sort is not worth starting threads
+static constexpr size_t PARALLEL_SORT_MIN = 1 << 16;
+
+// Entries are sorted by value instead of through an index so comparisons stay in cache
+struct SizeKey {
+    unsigned long long size;
+    uint32_t index;
+};
+
+static bool biggerFirst(const SizeKey& a, const SizeKey& b) {
+    return a.size != b.size ? a.size > b.size : a.index < b.index;
+}
+
+// Sorts `threads` runs concurrently, then merges neighbouring runs pairwise (also concurrently)
+// until a single run is left.
+static void parallelSort(vector<SizeKey>& items, size_t threads) {
+    threads = min(threads, items.size() / (PARALLEL_SORT_MIN / 2));
+    if(threads <= 1) {
+        sort(items.begin(), items.end(), biggerFirst);
+        return;
+    }
+    vector<size_t> bounds(threads + 1);
+    for(size_t i = 0; i <= threads; i++) {
+        bounds[i] = items.size() * i / threads;
+    }
+    {
+        vector<thread> workers;
+        for(size_t i = 0; i < threads; i++) {
+            workers.emplace_back([&items, &bounds, i] {
+                sort(items.begin() + static_cast<ptrdiff_t>(bounds[i]),
+                     items.begin() + static_cast<ptrdiff_t>(bounds[i + 1]), biggerFirst);
+            });
+        }
+        for(thread& worker : workers) worker.join();
+    }
+    vector<SizeKey> buffer(items.size());
+    while(bounds.size() > 2) {
+        size_t runs = bounds.size() - 1;
+        vector<size_t> merged{0};
+        vector<thread> workers;
+        for(size_t run = 0; run < runs; run += 2) {
+            auto first = items.begin() + static_cast<ptrdiff_t>(bounds[run]);
+            auto out = buffer.begin() + static_cast<ptrdiff_t>(bounds[run]);
+            if(run + 1 < runs) {
+                auto middle = items.begin() + static_cast<ptrdiff_t>(bounds[run + 1]);
+                auto last = items.begin() + static_cast<ptrdiff_t>(bounds[run + 2]);
+                workers.emplace_back([first, middle, last, out] {
+                    merge(first, middle, middle, last, out, biggerFirst);
+                });
+                merged.push_back(bounds[run + 2]);
+            }else {
+                copy(first, items.begin() + static_cast<ptrdiff_t>(bounds[run + 1]), out);
+                merged.push_back(bounds[run + 1]);
+            }
+        }
+        for(thread& worker : workers) worker.join();
+        items.swap(buffer);
+        bounds.swap(merged);
+    }
+}
+
+// Keep predicates, `all` lets the unfiltered ranking fill its keys without testing anything
+struct KeepAll {
+    static constexpr bool all = true;
+    bool operator()(uint32_t) const { return true; }
+};
+
+struct KeepPresent {
+    static constexpr bool all = false;
+    const vector<uint32_t>& parents;
+    uint32_t leaveOut;
+    bool operator()(uint32_t i) const { return parents[i] != leaveOut; }
+};
+
+template<typename Keep>
+static vector<uint32_t> rankKept(const vector<unsigned long long>& sizes, const RankLimit& limit, size_t threads, Keep keep) {
+    auto count = static_cast<uint32_t>(sizes.size());
+    vector<uint32_t> order;
+    if(limit.top == 0) return order;
+
+    if(limit.top < count / 8) {
+        // Few entries wanted: bounded heap whose front is the smallest entry kept so far,
+        // so most entries are rejected with a single comparison and nothing else is allocated.
+        vector<SizeKey> heap;
+        heap.reserve(limit.top);
+        for(uint32_t i = 0; i < count; i++) {
+            if(sizes[i] < limit.minSize || !keep(i)) continue;
+            SizeKey key{sizes[i], i};
+            if(heap.size() < limit.top) {
+                heap.push_back(key);
+                push_heap(heap.begin(), heap.end(), biggerFirst);
+            }else if(biggerFirst(key, heap.front())) {
+                pop_heap(heap.begin(), heap.end(), biggerFirst);
+                heap.back() = key;
+                push_heap(heap.begin(), heap.end(), biggerFirst);
+            }
+        }
+        sort_heap(heap.begin(), heap.end(), biggerFirst);
+        order.reserve(heap.size());
+        for(const SizeKey& key : heap) order.push_back(key.index);
+        return order;
+    }
+
+    vector<SizeKey> keys;
+    if(limit.minSize > 0 || !keep.all) {
+        for(uint32_t i = 0; i < count; i++) {
+            if(sizes[i] >= limit.minSize && keep(i)) keys.push_back({sizes[i], i});
+        }
+    }else {
+        keys.resize(count);
+        for(uint32_t i = 0; i < count; i++) keys[i] = {sizes[i], i};
+    }
+    if(limit.top < keys.size()) {
+        nth_element(keys.begin(), keys.begin() + static_cast<ptrdiff_t>(limit.top), keys.end(), biggerFirst);
+        keys.resize(limit.top);
+    }
+    parallelSort(keys, threads);
+    order.reserve(keys.size());
+    for(const SizeKey& key : keys) order.push_back(key.index);
+    return order;
+}
+
+vector<uint32_t> rankBySize(const vector<unsigned long long>& sizes, const RankLimit& limit, size_t threads) {
+    return rankKept(sizes, limit, threads, KeepAll());
+}
+
+vector<uint32_t> rankBySize(const vector<unsigned long long>& sizes, const RankLimit& limit, size_t threads,
+                            const vector<uint32_t>& parents, uint32_t leaveOut) {
+    return rankKept(sizes, limit, threads, KeepPresent{parents, leaveOut});
+}
@@ -0,0 +1,26 @@
+#ifndef FILESIZECALCULATOR_RANK_H
+#define FILESIZECALCULATOR_RANK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Which entries of a ranking the report needs
+struct RankLimit {
+    size_t top = std::numeric_limits<size_t>::max(); // at most this many entries
+    unsigned long long minSize = 0;                   // only entries at least this big
+
+    bool unlimited() const { return top == std::numeric_limits<size_t>::max() && minSize == 0; }
+};
+
+// Indices into sizes ordered biggest to smallest, equal sizes keep index order so the
+// result does not depend on the thread count or on the limit (a limited ranking is always
+// a prefix of the full one). Only the entries within limit are selected and sorted.
+std::vector<uint32_t> rankBySize(const std::vector<unsigned long long>& sizes, const RankLimit& limit, size_t threads);
+// The same without the entries i whose parents[i] is leaveOut (what a TreeWatcher removed).
+// They are left out before the limit, so the limit still counts what is there.
+std::vector<uint32_t> rankBySize(const std::vector<unsigned long long>& sizes, const RankLimit& limit, size_t threads,
+                                 const std::vector<uint32_t>& parents, uint32_t leaveOut);
+
+#endif //FILESIZECALCULATOR_RANK_H
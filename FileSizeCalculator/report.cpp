@@ -0,0 +1,151 @@
+#include "report.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "output.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Rows of a ranking at least as big as each division. The ranking is biggest first, so they
+// are found with a binary search.
+static vector<size_t> divisionEnds(const vector<uint32_t>& order, const vector<unsigned long long>& sizes,
+                                   const vector<unsigned long long>& divisions) {
+    vector<size_t> ends;
+    auto current = order.begin();
+    for(unsigned long long division : divisions) {
+        current = partition_point(current, order.end(), [&sizes, division](uint32_t index) {
+            return sizes[index] >= division;
+        });
+        ends.push_back(static_cast<size_t>(current - order.begin()));
+    }
+    return ends;
+}
+
+SectionLayout layoutSection(unsigned long long titleLine, size_t rows, const vector<size_t>& divisionEnds) {
+    SectionLayout layout;
+    layout.titleLine = titleLine;
+    unsigned long long line = titleLine + 2;
+    size_t current = 0;
+    for(size_t end : divisionEnds) {
+        end = max(end, current);
+        unsigned long long markerStart = line;
+        line += 1 + static_cast<unsigned long long>(end - current);
+        layout.markerLines.emplace_back(markerStart, line);
+        line++;
+        layout.divisionEnds.push_back(end);
+        current = end;
+    }
+    line += static_cast<unsigned long long>(rows - current);
+    layout.nextLine = line;
+    return layout;
+}
+
+void writeIndexLine(ReportWriter& out, string_view name, const SectionLayout& layout,
+                           const vector<unsigned long long>& divisions) {
+    out << name << ": L" << layout.titleLine << " | ";
+    for(size_t i = 0; i < divisions.size(); i++) {
+        out.size(divisions[i]) << ": L" << layout.markerLines[i].first << " - L" << layout.markerLines[i].second << " | ";
+    }
+}
+
+// writeRow(out, section, columns, rank) writes one row
+template<typename WriteRow>
+static void writeReportBody(ostream& stream, const ReportOutline& report, const MessageSink& messages,
+                            WriteRow writeRow) {
+    ReportWriter sortedOut(stream);
+    auto sectionRows = [&](ReportSection section) { return report.rows[static_cast<size_t>(section)]; };
+    auto sectionEnds = [&](ReportSection section) -> const vector<size_t>& {
+        return report.divisionEnds[static_cast<size_t>(section)];
+    };
+
+    SectionLayout files = layoutSection(8, sectionRows(ReportSection::Files), sectionEnds(ReportSection::Files));
+    // sections are separated by a blank line
+    SectionLayout foldersFull = layoutSection(files.nextLine + 1, sectionRows(ReportSection::FoldersFull),
+                                              sectionEnds(ReportSection::FoldersFull));
+    SectionLayout foldersPure = layoutSection(foldersFull.nextLine + 1, sectionRows(ReportSection::FoldersPure),
+                                              sectionEnds(ReportSection::FoldersPure));
+
+    ostringstream root;
+    root << fs::absolute(report.root);
+    sortedOut << "Sorted Output " << root.str() << " [";
+    sortedOut.size(report.totalSize) << "]\n\n";
+    writeIndexLine(sortedOut, "Files", files, report.fileDivisions);
+    sortedOut << '\n';
+    writeIndexLine(sortedOut, "Folders fullsort", foldersFull, report.folderDivisions);
+    sortedOut << '\n';
+    writeIndexLine(sortedOut, "Folders puresort", foldersPure, report.folderDivisions);
+    sortedOut << "\n\n\n";
+
+    sendMessage(messages, MessageLevel::Progress, "Writing... files...");
+    { // Files
+        sortedOut << "==== FILES START====\n";
+        // +3 for '. ' and 1 more for error
+        RowColumns columns{static_cast<int>(ceil(log10(report.fileCount))) + 3, report.longestPathName};
+        sortedOut.padded("Rank", columns.rank).padded("File", columns.path).padded("Size", 20).endLine();
+        writeSectionRows(sortedOut, files, sectionRows(ReportSection::Files), report.fileDivisions, [&](size_t rank) {
+            writeRow(sortedOut, ReportSection::Files, columns, rank);
+        });
+    }
+    RowColumns columns{static_cast<int>(ceil(log10(report.dirCount))) + 3, report.longestPathName};
+    auto writeFolderHeader = [&]() {
+        sortedOut.padded("Rank", columns.rank).padded("Folder", columns.path);
+        sortedOut.padded("Size (Full)", 20).padded("Size (Pure)", 20).endLine();
+    };
+    auto folderRows = [&](ReportSection section) {
+        return [&, section](size_t rank) { writeRow(sortedOut, section, columns, rank); };
+    };
+    sendMessage(messages, MessageLevel::Progress, "Writing... folders full...");
+    { // Folders all
+        sortedOut << '\n';
+        sortedOut << "==== FOLDERS FULL START ====\n";
+        writeFolderHeader();
+        writeSectionRows(sortedOut, foldersFull, sectionRows(ReportSection::FoldersFull), report.folderDivisions,
+                         folderRows(ReportSection::FoldersFull));
+    }
+    sendMessage(messages, MessageLevel::Progress, "Writing... folders pure...");
+    { // Folders pure
+        sortedOut << '\n';
+        sortedOut << "==== FOLDERS PURE START ====\n";
+        writeFolderHeader();
+        writeSectionRows(sortedOut, foldersPure, sectionRows(ReportSection::FoldersPure), report.folderDivisions,
+                         folderRows(ReportSection::FoldersPure));
+    }
+}
+
+bool writeReport(const Report& report, const fs::path& output, const MessageSink& messages) {
+    const ScanTree& tree = report.tree;
+    ReportOutline outline{tree.root, report.totalSize, tree.fileCount(), tree.dirCount(), report.longestPathName,
+                          {report.fileOrder.size(), report.folderOrder.size(), report.folderPureOrder.size()},
+                          {divisionEnds(report.fileOrder, tree.fileSize, report.fileDivisions),
+                           divisionEnds(report.folderOrder, tree.dirFull, report.folderDivisions),
+                           divisionEnds(report.folderPureOrder, tree.dirPure, report.folderDivisions)},
+                          report.fileDivisions, report.folderDivisions};
+    // ReportWriter hands over 1 MiB blocks, no need for a second buffer
+    return writeFileAtomically(output, [&](ostream& out) {
+        writeReportBody(out, outline, messages, [&](ReportWriter& writer, ReportSection section,
+                                                    const RowColumns& columns, size_t rank) {
+            if(section == ReportSection::Files) {
+                writer.fileRow(tree, columns, rank, report.fileOrder[rank - 1]);
+            }else {
+                const vector<uint32_t>& order = section == ReportSection::FoldersFull ? report.folderOrder : report.folderPureOrder;
+                writer.folderRow(tree, columns, rank, order[rank - 1]);
+            }
+        });
+    });
+}
+
+bool writeReport(const ReportOutline& outline, const fs::path& output,
+                 const function<bool(ReportWriter&, ReportSection, const RowColumns&, size_t)>& writeRow,
+                 const MessageSink& messages) {
+    return writeFileAtomically(output, [&](ostream& out) {
+        bool rowsOk = true;
+        writeReportBody(out, outline, messages, [&](ReportWriter& writer, ReportSection section,
+                                                    const RowColumns& columns, size_t rank) {
+            rowsOk = rowsOk && writeRow(writer, section, columns, rank);
+        });
+        if(!rowsOk) out.setstate(ios::failbit);
+    });
+}
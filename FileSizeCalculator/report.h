@@ -0,0 +1,98 @@
+#ifndef FILESIZECALCULATOR_REPORT_H
+#define FILESIZECALCULATOR_REPORT_H
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "format.h"
+#include "messages.h"
+#include "tree.h"
+
+// Everything the sorted text report is made of. Orders are rankings from rankBySize,
+// divisions are sorted biggest first.
+struct Report {
+    const ScanTree& tree;
+    unsigned long long totalSize;
+    const std::vector<uint32_t>& fileOrder;
+    const std::vector<uint32_t>& folderOrder;
+    const std::vector<uint32_t>& folderPureOrder;
+    const std::vector<unsigned long long>& fileDivisions;
+    const std::vector<unsigned long long>& folderDivisions;
+    int longestPathName; // path column width
+};
+
+// Writes the report in one sequential pass: every section and marker line number is
+// computed up front so the index at the top is written first. The file is written next
+// to `output` under a temporary name and renamed over it once complete. Each section is
+// announced to messages as it is written.
+// Returns false (after printing why) if it could not be written.
+bool writeReport(const Report& report, const std::filesystem::path& output, const MessageSink& messages = {});
+
+enum class ReportSection {
+    Files,
+    FoldersFull,
+    FoldersPure
+};
+
+// Everything about a report but its rows, for rankings that are not held in memory
+// (see external.h). Per ReportSection: the ranked rows and, per division, how many of them
+// are at least that big.
+struct ReportOutline {
+    std::filesystem::path root;
+    unsigned long long totalSize;
+    size_t fileCount, dirCount; // scanned entries, they size the rank columns
+    int longestPathName;        // path column width
+    size_t rows[3];
+    std::vector<size_t> divisionEnds[3];
+    std::vector<unsigned long long> fileDivisions, folderDivisions;
+};
+
+// writeReport with the rows coming from writeRow(out, section, columns, rank), which is
+// called for the ranks 1, 2, ... of each section in the order the report lists them. Once it
+// returns false no more rows are asked for and the report is not written.
+bool writeReport(const ReportOutline& outline, const std::filesystem::path& output,
+                 const std::function<bool(ReportWriter&, ReportSection, const RowColumns&, size_t)>& writeRow,
+                 const MessageSink& messages = {});
+
+// Where one ranking section lands in a report
+struct SectionLayout {
+    unsigned long long titleLine = 0;
+    std::vector<std::pair<unsigned long long, unsigned long long>> markerLines; // (Marker Start, Marker End) per division
+    std::vector<size_t> divisionEnds; // rows [previous end, end) belong to the division
+    unsigned long long nextLine = 0;  // first line after the section
+};
+
+// Section layout: title, column header, then per division a start marker, its rows and an end
+// marker, then the rows below every division. divisionEnds are the rows at least as big as
+// each division.
+SectionLayout layoutSection(unsigned long long titleLine, size_t rows, const std::vector<size_t>& divisionEnds);
+
+// "name: L<title> | <division>: L<start> - L<end> | ..." without the line end
+void writeIndexLine(ReportWriter& out, std::string_view name, const SectionLayout& layout,
+                    const std::vector<unsigned long long>& divisions);
+
+// Writes the rows of a section with their division markers, writeRow(rank) writes one row
+template<typename WriteRow>
+void writeSectionRows(ReportWriter& out, const SectionLayout& layout, size_t rows,
+                      const std::vector<unsigned long long>& divisions, WriteRow writeRow) {
+    size_t currentIndex = 0;
+    for(size_t i = 0; i < divisions.size(); i++) {
+        out << "Marker Start ";
+        out.size(divisions[i]).endLine();
+        for(; currentIndex < layout.divisionEnds[i]; currentIndex++) {
+            writeRow(currentIndex + 1);
+        }
+        out << "Marker End ";
+        out.size(divisions[i]).endLine();
+    }
+    // go through the rest
+    for(; currentIndex < rows; currentIndex++) {
+        writeRow(currentIndex + 1);
+    }
+}
+
+#endif //FILESIZECALCULATOR_REPORT_H
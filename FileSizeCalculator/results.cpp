@@ -0,0 +1,326 @@
+#include "results.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include "output.h"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr char RESULTS_MAGIC[8] = {'F', 'S', 'C', 'R', 'S', 'L', 'T', '\0'};
+static constexpr uint32_t RESULTS_VERSION = 2;
+static constexpr uint64_t BYTE_ORDER_MARK = 0x0102030405060708ull;
+
+struct ResultHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pathCharSize;
+    uint64_t byteOrder;
+    uint64_t totalSize;
+    uint64_t rootDir; // the last directory unless a watch added directories after it
+    uint64_t offsets[RESULT_SECTION_COUNT];
+    uint64_t counts[RESULT_SECTION_COUNT];
+};
+
+static constexpr size_t ELEMENT_SIZE[RESULT_SECTION_COUNT] = {
+    4, 4, 8, 8,             // directories
+    4, 4, 8,                // files
+    8, sizeof(PathChar),    // names
+    8, 4, 8, 4,             // children
+    4, 4, 4,                // rankings
+    8, 8, 8, 8, 8           // divisions
+};
+
+// Children of every directory grouped by parent and sorted by name
+static void sortedChildren(const ScanTree& tree, const vector<uint32_t>& parents, const vector<uint32_t>& names,
+                           vector<uint64_t>& start, vector<uint32_t>& children) {
+    size_t dirs = tree.dirCount();
+    start.assign(dirs + 1, 0);
+    for(uint32_t parent : parents) {
+        if(parent < dirs) start[parent + 1]++;
+    }
+    for(size_t dir = 0; dir < dirs; dir++) start[dir + 1] += start[dir];
+    children.resize(start[dirs]);
+    vector<uint64_t> next(start.begin(), start.end() - 1);
+    for(uint32_t child = 0; child < parents.size(); child++) {
+        if(parents[child] < dirs) children[next[parents[child]]++] = child;
+    }
+    for(size_t dir = 0; dir < dirs; dir++) {
+        sort(children.begin() + static_cast<ptrdiff_t>(start[dir]), children.begin() + static_cast<ptrdiff_t>(start[dir + 1]),
+             [&](uint32_t a, uint32_t b) { return tree.names[names[a]] < tree.names[names[b]]; });
+    }
+}
+
+static vector<uint64_t> divisionEnds(const vector<uint32_t>& order, const vector<unsigned long long>& sizes,
+                                     const vector<unsigned long long>& divisions) {
+    vector<uint64_t> ends;
+    for(unsigned long long division : divisions) {
+        auto end = partition_point(order.begin(), order.end(), [&](uint32_t index) { return sizes[index] >= division; });
+        ends.push_back(static_cast<uint64_t>(end - order.begin()));
+    }
+    return ends;
+}
+
+// The root as an absolute path without a trailing separator, whatever --folder was typed as
+static PathString absoluteRoot(const fs::path& root) {
+    fs::path normal = fs::absolute(root).lexically_normal();
+    if(!normal.has_filename() && normal.has_relative_path()) normal = normal.parent_path();
+    return normal.native();
+}
+
+bool writeResults(const Report& report, const fs::path& path) {
+    const ScanTree& tree = report.tree;
+    uint32_t rootDir = static_cast<uint32_t>(find(tree.dirParent.begin(), tree.dirParent.end(), NO_DIR) - tree.dirParent.begin());
+    // the root's name is stored after the pool's names, the directory names point to it
+    PathString rootName = absoluteRoot(tree.root);
+    vector<uint32_t> dirNames(tree.dirName);
+    dirNames[rootDir] = static_cast<uint32_t>(tree.names.size());
+    vector<uint64_t> nameOffsets{0};
+    nameOffsets.reserve(tree.names.size() + 2);
+    for(uint32_t id = 0; id < tree.names.size(); id++) {
+        nameOffsets.push_back(nameOffsets.back() + tree.names[id].size());
+    }
+    nameOffsets.push_back(nameOffsets.back() + rootName.size());
+    vector<uint64_t> dirChildStart, fileChildStart;
+    vector<uint32_t> dirChildren, fileChildren;
+    sortedChildren(tree, tree.dirParent, tree.dirName, dirChildStart, dirChildren);
+    sortedChildren(tree, tree.fileParent, tree.fileName, fileChildStart, fileChildren);
+    vector<uint64_t> fileEnds = divisionEnds(report.fileOrder, tree.fileSize, report.fileDivisions);
+    vector<uint64_t> folderEnds = divisionEnds(report.folderOrder, tree.dirFull, report.folderDivisions);
+    vector<uint64_t> folderPureEnds = divisionEnds(report.folderPureOrder, tree.dirPure, report.folderDivisions);
+
+    // names are written from the pool in blocks, everything else straight from its column
+    const void* columns[RESULT_SECTION_COUNT] = {
+        tree.dirParent.data(), dirNames.data(), tree.dirFull.data(), tree.dirPure.data(),
+        tree.fileParent.data(), tree.fileName.data(), tree.fileSize.data(),
+        nameOffsets.data(), nullptr,
+        dirChildStart.data(), dirChildren.data(), fileChildStart.data(), fileChildren.data(),
+        report.fileOrder.data(), report.folderOrder.data(), report.folderPureOrder.data(),
+        report.fileDivisions.data(), fileEnds.data(), report.folderDivisions.data(), folderEnds.data(), folderPureEnds.data()
+    };
+    ResultHeader header{};
+    memcpy(header.magic, RESULTS_MAGIC, sizeof(header.magic));
+    header.version = RESULTS_VERSION;
+    header.pathCharSize = sizeof(PathChar);
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.totalSize = report.totalSize;
+    header.rootDir = rootDir;
+    uint64_t counts[RESULT_SECTION_COUNT] = {
+        tree.dirCount(), tree.dirCount(), tree.dirCount(), tree.dirCount(),
+        tree.fileCount(), tree.fileCount(), tree.fileCount(),
+        nameOffsets.size(), nameOffsets.back(),
+        dirChildStart.size(), dirChildren.size(), fileChildStart.size(), fileChildren.size(),
+        report.fileOrder.size(), report.folderOrder.size(), report.folderPureOrder.size(),
+        report.fileDivisions.size(), fileEnds.size(), report.folderDivisions.size(), folderEnds.size(), folderPureEnds.size()
+    };
+    uint64_t offset = sizeof(header);
+    for(size_t section = 0; section < RESULT_SECTION_COUNT; section++) {
+        header.offsets[section] = offset;
+        header.counts[section] = counts[section];
+        offset = (offset + counts[section] * ELEMENT_SIZE[section] + 7) & ~7ull;
+    }
+
+    return writeFileAtomically(path, [&](ostream& out) {
+        static constexpr char PADDING[8] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for(size_t section = 0; section < RESULT_SECTION_COUNT; section++) {
+            uint64_t bytes = counts[section] * ELEMENT_SIZE[section];
+            if(section == NameChars) {
+                PathString block;
+                for(uint32_t id = 0; id < tree.names.size(); id++) {
+                    block += tree.names[id];
+                    if(block.size() >= (1 << 20)) {
+                        out.write(reinterpret_cast<const char*>(block.data()), static_cast<streamsize>(block.size() * sizeof(PathChar)));
+                        block.clear();
+                    }
+                }
+                block += rootName;
+                out.write(reinterpret_cast<const char*>(block.data()), static_cast<streamsize>(block.size() * sizeof(PathChar)));
+            }else {
+                out.write(static_cast<const char*>(columns[section]), static_cast<streamsize>(bytes));
+            }
+            out.write(PADDING, static_cast<streamsize>((8 - bytes % 8) % 8));
+        }
+    }, ios::binary);
+}
+
+ResultFile::~ResultFile() {
+#ifdef __unix__
+    if(mapped) {
+        munmap(const_cast<char*>(data), length);
+        return;
+    }
+#endif
+    delete[] data;
+}
+
+bool ResultFile::open(const fs::path& path) {
+    auto fail = [&path](const string& why) {
+        cerr << "Error failed to open results '" << path.string() << "': " << why << endl;
+        return false;
+    };
+#ifdef __unix__
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return fail(error_code(errno, system_category()).message());
+    struct stat st{};
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return fail("cannot read");
+    }
+    length = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) return fail(error_code(errno, system_category()).message());
+    data = static_cast<const char*>(mapping);
+    mapped = true;
+#else
+    error_code ec;
+    length = static_cast<size_t>(fs::file_size(path, ec));
+    if(ec) return fail(ec.message());
+    // new[] memory is aligned for any scalar type, like a mapping
+    char* buffer = new char[length];
+    data = buffer;
+    ifstream in(path, ios::binary);
+    if(!in.read(buffer, static_cast<streamsize>(length))) return fail("cannot read");
+#endif
+
+    ResultHeader header{};
+    if(length < sizeof(header)) return fail("not a results file");
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, RESULTS_MAGIC, sizeof(header.magic)) != 0) return fail("not a results file");
+    if(header.version != RESULTS_VERSION || header.pathCharSize != sizeof(PathChar) || header.byteOrder != BYTE_ORDER_MARK) {
+        return fail("written by another version or platform");
+    }
+    for(size_t section = 0; section < RESULT_SECTION_COUNT; section++) {
+        uint64_t offset = header.offsets[section], count = header.counts[section];
+        if(offset % 8 != 0 || offset > length || count > (length - offset) / ELEMENT_SIZE[section]) return fail("corrupt section table");
+        sectionOffset[section] = offset;
+        sectionCount[section] = count;
+    }
+    size_t dirs = sectionCount[DirFull], files = sectionCount[FileSize];
+    bool consistent = dirs > 0 && dirs < NO_DIR
+                      && sectionCount[DirParent] == dirs && sectionCount[DirName] == dirs && sectionCount[DirPure] == dirs
+                      && sectionCount[FileParent] == files && sectionCount[FileName] == files
+                      && sectionCount[NameOffsets] > 0
+                      && sectionCount[DirChildStart] == dirs + 1 && sectionCount[FileChildStart] == dirs + 1
+                      && sectionCount[FileDivisionEnds] == sectionCount[FileDivisions]
+                      && sectionCount[FolderDivisionEnds] == sectionCount[FolderDivisions]
+                      && sectionCount[FolderPureDivisionEnds] == sectionCount[FolderDivisions];
+    if(!consistent || header.rootDir >= dirs) return fail("corrupt section table");
+    total = header.totalSize;
+    root = static_cast<uint32_t>(header.rootDir);
+    return true;
+}
+
+PathView ResultFile::name(uint32_t id) const {
+    auto offsets = section<uint64_t>(NameOffsets);
+    auto chars = section<PathChar>(NameChars);
+    if(id + 1 >= offsets.size() || offsets[id] > offsets[id + 1] || offsets[id + 1] > chars.size()) return {};
+    return {chars.data() + offsets[id], offsets[id + 1] - offsets[id]};
+}
+
+// Same separator rule as ScanTree
+void ResultFile::appendDirPath(uint32_t dir, PathString& out) const {
+    auto parents = section<uint32_t>(DirParent);
+    auto names = section<uint32_t>(DirName);
+    vector<uint32_t> chain;
+    for(uint32_t current = dir; current < dirCount() && chain.size() < dirCount(); current = parents[current]) {
+        chain.push_back(current);
+    }
+    bool rootNeedsSeparator = fs::path(PathString(name(names[rootDir()]))).has_filename();
+    for(size_t i = chain.size(); i-- > 0;) {
+        if(i + 1 < chain.size() && (i + 2 < chain.size() || rootNeedsSeparator)) {
+            out += fs::path::preferred_separator;
+        }
+        out += name(names[chain[i]]);
+    }
+}
+
+string ResultFile::dirPath(uint32_t dir) const {
+    PathString out;
+    appendDirPath(dir, out);
+    return fs::path(out).string();
+}
+
+string ResultFile::filePath(uint32_t file) const {
+    uint32_t parent = section<uint32_t>(FileParent)[file];
+    PathString out;
+    appendDirPath(parent, out);
+    if(parent != rootDir() || fs::path(out).has_filename()) {
+        out += fs::path::preferred_separator;
+    }
+    out += name(section<uint32_t>(FileName)[file]);
+    return fs::path(out).string();
+}
+
+// Binary search among the children of dir, which are sorted by name
+static uint32_t findChild(const ResultFile& results, span<const uint64_t> start, span<const uint32_t> children,
+                          span<const uint32_t> names, uint32_t dir, PathView wanted) {
+    if(start[dir] > start[dir + 1] || start[dir + 1] > children.size()) return NO_DIR;
+    auto first = children.begin() + static_cast<ptrdiff_t>(start[dir]);
+    auto last = children.begin() + static_cast<ptrdiff_t>(start[dir + 1]);
+    auto found = lower_bound(first, last, wanted, [&](uint32_t child, PathView name) {
+        return results.name(names[child]) < name;
+    });
+    return found != last && results.name(names[*found]) == wanted ? *found : NO_DIR;
+}
+
+// Without a trailing separator, "dir/" and "dir" have to compare equal
+static fs::path withoutTrailingSeparator(const fs::path& path) {
+    fs::path normal = path.lexically_normal();
+    return !normal.has_filename() && normal.has_relative_path() ? normal.parent_path() : normal;
+}
+
+bool ResultFile::findParent(const fs::path& path, uint32_t& dir, PathString& last) const {
+    // the root is stored absolute and normalized, a relative path is first taken as relative to
+    // the working directory like --folder was
+    fs::path rootPath(PathString(name(section<uint32_t>(DirName)[rootDir()])));
+    error_code ec;
+    fs::path absolutePath = fs::absolute(path, ec);
+    fs::path relative = ec ? fs::path() : withoutTrailingSeparator(absolutePath).lexically_relative(rootPath);
+    if(relative.empty() || *relative.begin() == "..") {
+        if(path.is_absolute()) return false;
+        relative = path.lexically_normal();
+    }
+    dir = rootDir();
+    last.clear();
+    for(const fs::path& component : relative) {
+        if(component == "." || component.empty()) continue;
+        if(!last.empty()) {
+            dir = findChild(*this, section<uint64_t>(DirChildStart), section<uint32_t>(DirChildren),
+                            section<uint32_t>(DirName), dir, last);
+            if(dir == NO_DIR) return false;
+        }
+        last = component.native();
+    }
+    return true;
+}
+
+uint32_t ResultFile::findDir(const fs::path& path) const {
+    uint32_t dir;
+    PathString last;
+    if(!findParent(path, dir, last)) return NO_DIR;
+    if(last.empty()) return dir;
+    return findChild(*this, section<uint64_t>(DirChildStart), section<uint32_t>(DirChildren),
+                     section<uint32_t>(DirName), dir, last);
+}
+
+uint32_t ResultFile::findFile(const fs::path& path) const {
+    uint32_t dir;
+    PathString last;
+    if(!findParent(path, dir, last) || last.empty()) return NO_DIR;
+    return findChild(*this, section<uint64_t>(FileChildStart), section<uint32_t>(FileChildren),
+                     section<uint32_t>(FileName), dir, last);
+}
@@ -0,0 +1,88 @@
+#ifndef FILESIZECALCULATOR_RESULTS_H
+#define FILESIZECALCULATOR_RESULTS_H
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+
+#include "report.h"
+
+// Binary results: the report's data as columns that are used straight from a memory mapping.
+// Every section starts 8 byte aligned at the offset the header's section table gives. Names
+// are a string table (offsets into one character array), each directory's files and
+// subdirectories are also listed sorted by name so paths resolve with binary searches.
+// Rankings are the report's orders, division ends are offsets into them. Like snapshots the
+// file is only meant to be read on the machine (byte order, path encoding) that wrote it.
+enum ResultSection : uint32_t {
+    DirParent,       // uint32_t per directory, NO_DIR for the root
+    DirName,         // uint32_t name per directory, the root's name is its absolute normalized path
+    DirFull,         // uint64_t per directory
+    DirPure,         // uint64_t per directory
+    FileParent,      // uint32_t per file
+    FileName,        // uint32_t per file
+    FileSize,        // uint64_t per file
+    NameOffsets,     // uint64_t per name + 1, name i is NameChars[NameOffsets[i] .. NameOffsets[i + 1])
+    NameChars,       // PathChar
+    DirChildStart,   // uint64_t per directory + 1, into DirChildren
+    DirChildren,     // uint32_t subdirectories, sorted by name within a directory
+    FileChildStart,  // uint64_t per directory + 1, into FileChildren
+    FileChildren,    // uint32_t files, sorted by name within a directory
+    FileOrder,       // uint32_t rankings, biggest first
+    FolderOrder,
+    FolderPureOrder,
+    FileDivisions,   // uint64_t division sizes, biggest first
+    FileDivisionEnds, // uint64_t per file division: entries of FileOrder at least that big
+    FolderDivisions,
+    FolderDivisionEnds,
+    FolderPureDivisionEnds,
+    RESULT_SECTION_COUNT
+};
+
+// Returns false (after printing why) if it could not be written
+bool writeResults(const Report& report, const std::filesystem::path& path);
+
+// A results file mapped into memory (read in whole where mmap is not available)
+class ResultFile {
+public:
+    ResultFile() = default;
+    ResultFile(const ResultFile&) = delete;
+    ResultFile& operator=(const ResultFile&) = delete;
+    ~ResultFile();
+
+    // Returns false (after printing why) if path is not a readable results file
+    bool open(const std::filesystem::path& path);
+
+    template<typename T>
+    std::span<const T> section(ResultSection which) const {
+        return {reinterpret_cast<const T*>(data + sectionOffset[which]), sectionCount[which]};
+    }
+    unsigned long long totalSize() const { return total; }
+    size_t dirCount() const { return sectionCount[DirFull]; }
+    size_t fileCount() const { return sectionCount[FileSize]; }
+    uint32_t rootDir() const { return root; }
+    PathView name(uint32_t id) const;
+
+    // Full paths, starting at the absolute root
+    std::string dirPath(uint32_t dir) const;
+    std::string filePath(uint32_t file) const;
+    // Directory or file at `path` (absolute, relative to the working directory or relative to
+    // the root), NO_DIR if there is none
+    uint32_t findDir(const std::filesystem::path& path) const;
+    uint32_t findFile(const std::filesystem::path& path) const;
+
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    unsigned long long total = 0;
+    uint32_t root = 0;
+    uint64_t sectionOffset[RESULT_SECTION_COUNT]{};
+    uint64_t sectionCount[RESULT_SECTION_COUNT]{};
+
+    void appendDirPath(uint32_t dir, PathString& out) const;
+    // The directory that contains the last component of path, and that component
+    bool findParent(const std::filesystem::path& path, uint32_t& dir, PathString& last) const;
+};
+
+#endif //FILESIZECALCULATOR_RESULTS_H
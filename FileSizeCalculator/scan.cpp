@@ -0,0 +1,748 @@
+#include "scan.h"
+
+#include "filter.h"
+#include "groups.h"
+
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <system_error>
+#include <algorithm>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Appends a directory whose files and subdirectories are already in the tree and links them to it.
+// This is what numbers directories in post-order.
+static uint32_t finishDir(ScanTree& tree, uint32_t name,
+                          unsigned long long sizeWithFolders, unsigned long long sizeNoFolders,
+                          long long mtime, unsigned long long inode,
+                          const vector<pair<size_t, size_t>>& fileRanges, const vector<uint32_t>& subdirs) {
+    auto dir = static_cast<uint32_t>(tree.dirCount());
+    tree.dirParent.push_back(NO_DIR);
+    tree.dirName.push_back(name);
+    tree.dirFull.push_back(sizeWithFolders);
+    tree.dirPure.push_back(sizeNoFolders);
+    tree.dirMtime.push_back(mtime);
+    tree.dirInode.push_back(inode);
+    tree.dirFilesBefore.push_back(0); // set by the parent
+    for(auto [first, last] : fileRanges) {
+        fill(tree.fileParent.begin() + static_cast<ptrdiff_t>(first), tree.fileParent.begin() + static_cast<ptrdiff_t>(last), dir);
+    }
+    for(uint32_t subdir : subdirs) {
+        tree.dirParent[subdir] = dir;
+    }
+    return dir;
+}
+
+static void addFile(ScanTree& tree, PathView name, unsigned long long size, size_t pathLength) {
+    tree.fileParent.push_back(NO_DIR);
+    tree.fileName.push_back(tree.names.intern(name));
+    tree.fileSize.push_back(size);
+    tree.longestPathName = max(tree.longestPathName, pathLength);
+}
+
+static void count(atomic<unsigned long long>& counter, unsigned long long amount = 1) {
+    counter.fetch_add(amount, memory_order_relaxed);
+}
+
+void countError(ScanStats& stats, const char* what, const fs::path& path, const string& why) {
+    count(stats.errors);
+    if(!stats.messages) return;
+    ostringstream message;
+    message << "err " << what << ' ' << absolute(path) << ": " << why;
+    stats.messages(MessageLevel::Error, message.str());
+}
+
+// Modification time of a directory in the unit of ScanTree::dirMtime, 0 if it cannot be read
+static long long portableMtime(const fs::path& path, ScanStats& stats) {
+    count(stats.stats);
+    error_code ec;
+    fs::file_time_type time = fs::last_write_time(path, ec);
+    if(ec) return 0;
+    auto sinceEpoch = chrono::file_clock::to_sys(time).time_since_epoch();
+    return chrono::duration_cast<chrono::nanoseconds>(sinceEpoch).count();
+}
+
+// Owner and modification time of a file for FileGroups
+static FileStamp portableStamp(const fs::path& path, ScanStats& stats) {
+    FileStamp stamp;
+#ifdef __linux__
+    count(stats.stats);
+    struct stat st{};
+    if(stat(path.c_str(), &st) == 0) {
+        stamp.owner = st.st_uid;
+        stamp.mtime = st.st_mtim.tv_sec * 1'000'000'000ll + st.st_mtim.tv_nsec;
+    }
+#else
+    stamp.mtime = portableMtime(path, stats);
+#endif
+    return stamp;
+}
+
+// Counts a listed file into the groups, if there are any
+static void addToGroups(FileGroups* groups, size_t worker, const fs::directory_entry& entry,
+                        unsigned long long size, ScanStats& stats) {
+    if(!groups) return;
+    FileStamp stamp;
+    if(groups->needsStamp()) stamp = portableStamp(entry.path(), stats);
+    groups->add(worker, entry.path().filename().native(), size, stamp);
+}
+
+// Whether the filter leaves out the entry `name` of the directory at `parent`
+static bool skipped(const ScanFilter* filter, PathView parent, PathView name, bool isDirectory, ScanStats& stats) {
+    if(!filter || !filter->skips(parent, name, isDirectory)) return false;
+    count(stats.skipped);
+    return true;
+}
+
+// Whether a directory is on another filesystem than the root (ScanFilter::oneFileSystem),
+// checked before it is opened
+static bool portableOtherDevice(const ScanFilter* filter, const fs::path& dir, ScanStats& stats) {
+    if(!filter || !filter->sameFileSystem()) return false;
+    count(stats.stats);
+    if(!filter->otherDevice(dir)) return false;
+    count(stats.skipped);
+    return true;
+}
+
+static uint32_t recursiveCalc(ScanTree& tree, ScanStats& stats, const ScanFilter* filter, FileGroups* groups,
+                              const fs::path& path, uint32_t name, size_t pathLength, bool isRoot) {
+    unsigned long long sizeWithFolders = 0;
+    unsigned long long sizeNoFolders = 0;
+    fs::directory_iterator directoryIterator;
+    count(stats.dirOpens);
+    try {
+        directoryIterator = fs::directory_iterator(path);
+    }catch(const fs::filesystem_error& err) {
+        countError(stats, "directory_iterator", path, err.what());
+        return NO_DIR;
+    }
+    long long mtime = portableMtime(path, stats);
+    vector<pair<size_t, size_t>> fileRanges;
+    vector<uint32_t> subdirs;
+    size_t rangeStart = tree.fileCount(), filesListed = 0;
+    for(const fs::directory_entry& entry : directoryIterator) {
+        PathString entryName = entry.path().filename().native();
+        bool isDirectory = entry.is_directory();
+        if(skipped(filter, path.native(), entryName, isDirectory, stats)) continue;
+        size_t entryLength = tree.childPathLength(pathLength, isRoot, entryName.size());
+        if(isDirectory) {
+            if(portableOtherDevice(filter, entry.path(), stats)) continue;
+            if(rangeStart < tree.fileCount()) fileRanges.emplace_back(rangeStart, tree.fileCount());
+            uint32_t subdir = recursiveCalc(tree, stats, filter, groups, entry.path(), tree.names.intern(entryName), entryLength, false);
+            if(subdir != NO_DIR) {
+                sizeWithFolders += tree.dirFull[subdir];
+                tree.dirFilesBefore[subdir] = static_cast<uint32_t>(filesListed);
+                subdirs.push_back(subdir);
+            }
+            rangeStart = tree.fileCount();
+        }else {
+            unsigned long long fileSize = 0ull;
+            count(stats.stats);
+            try {
+                fileSize = static_cast<unsigned long long>(entry.file_size());
+            }catch(const fs::filesystem_error& err) {
+                countError(stats, "file_size", entry.path(), err.what());
+            }
+            sizeWithFolders += fileSize;
+            sizeNoFolders += fileSize;
+
+            addFile(tree, entryName, fileSize, entryLength);
+            filesListed++;
+            addToGroups(groups, 0, entry, fileSize, stats);
+            count(stats.files);
+        }
+    }
+    if(rangeStart < tree.fileCount()) fileRanges.emplace_back(rangeStart, tree.fileCount());
+    count(stats.dirs);
+    return finishDir(tree, name, sizeWithFolders, sizeNoFolders, mtime, 0, fileRanges, subdirs);
+}
+
+unsigned long long recursiveCalc(ScanTree& tree, ScanStats& stats, const ScanFilter* filter, FileGroups* groups) {
+    tree.scanStart = unixNanosNow();
+    if(groups) groups->prepare(1);
+    tree.filterRules = filter ? filter->rules() : string();
+    const PathString& rootName = tree.root.native();
+    uint32_t root = recursiveCalc(tree, stats, filter, groups, tree.root, tree.names.intern(rootName), rootName.size(), true);
+    return root == NO_DIR ? 0 : tree.dirFull[root];
+}
+
+static bool streamCalc(const fs::path& path, const ScanCallbacks& callbacks, ScanStats& stats,
+                       const ScanFilter* filter, FileGroups* groups, const stop_token& stop,
+                       unsigned long long& sizeWithFolders) {
+    sizeWithFolders = 0;
+    unsigned long long sizeNoFolders = 0;
+    fs::directory_iterator directoryIterator;
+    count(stats.dirOpens);
+    try {
+        directoryIterator = fs::directory_iterator(path);
+    }catch(const fs::filesystem_error& err) {
+        countError(stats, "directory_iterator", path, err.what());
+        return false;
+    }
+    for(const fs::directory_entry& entry : directoryIterator) {
+        if(stop.stop_requested()) return false;
+        bool isDirectory = entry.is_directory();
+        if(filter && skipped(filter, path.native(), entry.path().filename().native(), isDirectory, stats)) continue;
+        if(isDirectory) {
+            if(portableOtherDevice(filter, entry.path(), stats)) continue;
+            unsigned long long subdirSize;
+            if(streamCalc(entry.path(), callbacks, stats, filter, groups, stop, subdirSize)) {
+                sizeWithFolders += subdirSize;
+            }
+        }else {
+            unsigned long long fileSize = 0ull;
+            count(stats.stats);
+            try {
+                fileSize = static_cast<unsigned long long>(entry.file_size());
+            }catch(const fs::filesystem_error& err) {
+                countError(stats, "file_size", entry.path(), err.what());
+            }
+            sizeWithFolders += fileSize;
+            sizeNoFolders += fileSize;
+            if(callbacks.file) callbacks.file(entry.path(), fileSize);
+            addToGroups(groups, 0, entry, fileSize, stats);
+            count(stats.files);
+        }
+    }
+    // a stop during the last subdirectory
+    if(stop.stop_requested()) return false;
+    if(callbacks.dir) callbacks.dir(path, sizeWithFolders, sizeNoFolders);
+    count(stats.dirs);
+    return true;
+}
+
+unsigned long long streamCalc(const fs::path& root, const ScanCallbacks& callbacks, ScanStats& stats,
+                              const ScanFilter* filter, FileGroups* groups, stop_token stop) {
+    if(groups) groups->prepare(1);
+    unsigned long long total;
+    return streamCalc(root, callbacks, stats, filter, groups, stop, total) ? total : 0;
+}
+
+struct DirFd;
+
+#ifdef __linux__
+bool nativeBackendAvailable() {
+    return true;
+}
+
+// Owning directory file descriptor, shared by a directory and its not yet opened subdirectories.
+// `held` counts the ones that are open.
+struct DirFd {
+    int fd;
+    atomic<size_t>& held;
+    DirFd(int fd, atomic<size_t>& held) : fd(fd), held(held) { held.fetch_add(1, memory_order_relaxed); }
+    DirFd(const DirFd&) = delete;
+    DirFd& operator=(const DirFd&) = delete;
+    ~DirFd() {
+        close(fd);
+        held.fetch_sub(1, memory_order_relaxed);
+    }
+};
+
+// Record layout returned by getdents64
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#else
+bool nativeBackendAvailable() {
+    return false;
+}
+#endif
+
+// One directory scanned by parallelCalc. Entries are kept in directory order so that
+// mergeChunk can build exactly the tree recursiveCalc would have produced.
+struct DirChunk {
+    fs::path path;
+    shared_ptr<DirFd> parentFd; // native backend opens path.filename() relative to this
+    uint32_t cached = NO_DIR;   // the same directory in the previous scan
+    long long mtime = 0;
+    unsigned long long inode = 0;
+    bool failed = false;
+    bool skipped = false; // on another filesystem, left out without an error
+    unsigned long long sizeNoFolders = 0;
+    PathString names; // file names back to back
+    vector<pair<size_t, unsigned long long>> files; // (end of the name in names, size)
+    // (number of files seen before this subdirectory, subdirectory)
+    vector<pair<size_t, unique_ptr<DirChunk>>> subdirs;
+
+    void addFile(PathView name, unsigned long long size) {
+        names += name;
+        files.emplace_back(names.size(), size);
+        sizeNoFolders += size;
+    }
+};
+
+// Per-thread deque: the owner pushes/pops at the back (depth-first, cache friendly),
+// idle threads steal from the front (the oldest, usually largest, subtrees).
+class WorkDeque {
+    mutex lock;
+    deque<DirChunk*> items;
+public:
+    void push(DirChunk* chunk) {
+        lock_guard<mutex> guard(lock);
+        items.push_back(chunk);
+    }
+    bool pop(DirChunk*& chunk) {
+        lock_guard<mutex> guard(lock);
+        if(items.empty()) return false;
+        chunk = items.back();
+        items.pop_back();
+        return true;
+    }
+    bool steal(DirChunk*& chunk) {
+        lock_guard<mutex> guard(lock);
+        if(items.empty()) return false;
+        chunk = items.front();
+        items.pop_front();
+        return true;
+    }
+};
+
+struct ParallelScan {
+    vector<WorkDeque> deques;
+    atomic<ScanBackend> backend;
+    atomic<size_t> pending{0}; // chunks pushed but not yet scanned
+    ScanStats& stats;
+    const ScanFilter* filter;
+    FileGroups* groups;
+    mutex doneLock;
+    condition_variable done;
+    // Queued subdirectories keep their parent's fd open. Past the limit they are opened by
+    // path instead, so a wide queue cannot use up the process's descriptors.
+    atomic<size_t> heldDirFds{0};
+    size_t maxHeldDirFds = SIZE_MAX;
+    // Set once a directory waited out the whole retry on EMFILE/ENFILE, later ones fail at once
+    atomic<bool> outOfFds{false};
+
+    // Previous scan of the same root. A directory whose mtime and inode did not change still
+    // has the same entries, so they are taken from there instead of being listed again.
+    const ScanTree* previous;
+    unique_ptr<TreeChildren> previousChildren;
+    unordered_map<uint64_t, uint32_t> previousDirs; // (parent << 32 | name) -> directory
+    long long trustedBefore = 0;
+    static constexpr long long MTIME_SLACK = 2'000'000'000; // FAT has 2 s timestamps
+
+    ParallelScan(size_t threads, ScanBackend backend, ScanStats& stats, const ScanTree* previous,
+                 const ScanFilter* filter, FileGroups* groups)
+            : deques(threads), backend(backend), stats(stats), filter(filter), groups(groups), previous(previous) {
+        if(!previous) return;
+        previousChildren = make_unique<TreeChildren>(*previous);
+        previousDirs.reserve(previous->dirCount());
+        for(uint32_t dir = 0; dir < previous->dirCount(); dir++) {
+            uint32_t parent = previous->dirParent[dir];
+            if(parent != NO_DIR) previousDirs.emplace(static_cast<uint64_t>(parent) << 32 | previous->dirName[dir], dir);
+        }
+        // A change within the timestamp granularity of the moment a directory was listed can
+        // leave its mtime as it was, only directories that were older than that are trusted.
+        trustedBefore = previous->scanStart - MTIME_SLACK;
+    }
+
+    uint32_t previousChild(uint32_t cachedParent, PathView name) const {
+        if(cachedParent == NO_DIR) return NO_DIR;
+        uint32_t nameId = previous->names.find(name);
+        if(nameId == NO_NAME) return NO_DIR;
+        auto found = previousDirs.find(static_cast<uint64_t>(cachedParent) << 32 | nameId);
+        return found == previousDirs.end() ? NO_DIR : found->second;
+    }
+
+    bool unchanged(const DirChunk& chunk) const {
+        // the previous scan did not keep owners and times, those files are stat'ed again
+        if(groups && groups->needsStamp()) return false;
+        if(chunk.cached == NO_DIR || chunk.mtime == 0) return false;
+        long long mtime = previous->dirMtime[chunk.cached];
+        unsigned long long inode = previous->dirInode[chunk.cached];
+        return mtime == chunk.mtime && mtime < trustedBefore && (inode == 0 || chunk.inode == 0 || inode == chunk.inode);
+    }
+
+    // Fills chunk with the entries the previous scan listed. File sizes are taken as they
+    // were, subdirectories are still queued since their own contents may have changed.
+    void reuseCached(DirChunk& chunk, size_t self, const shared_ptr<DirFd>& dirFd) {
+        const ScanTree& old = *previous;
+        for(size_t i = previousChildren->start[chunk.cached]; i < previousChildren->start[chunk.cached + 1]; i++) {
+            uint32_t entry = previousChildren->entries[i];
+            if(entry & TreeChildren::DIR_ENTRY) {
+                uint32_t dir = entry & ~TreeChildren::DIR_ENTRY;
+                addSubdir(chunk, chunk.path / old.names[old.dirName[dir]], self, dir, dirFd);
+            }else {
+                chunk.addFile(old.names[old.fileName[entry]], old.fileSize[entry]);
+                if(groups) groups->add(self, old.names[old.fileName[entry]], old.fileSize[entry], {});
+            }
+        }
+        count(stats.reusedDirs);
+    }
+
+    // The child is fully set up before it is published, another worker may steal it right away
+    void addSubdir(DirChunk& chunk, fs::path&& path, size_t self, uint32_t cached, const shared_ptr<DirFd>& parentFd) {
+        auto child = make_unique<DirChunk>();
+        child->path = std::move(path);
+        child->parentFd = parentFd;
+        child->cached = cached;
+        DirChunk* task = child.get();
+        chunk.subdirs.emplace_back(chunk.files.size(), std::move(child));
+        pending.fetch_add(1, memory_order_relaxed);
+        deques[self].push(task);
+    }
+
+    void listPortable(DirChunk& chunk, size_t self) {
+        chunk.mtime = portableMtime(chunk.path, stats);
+        if(unchanged(chunk)) {
+            reuseCached(chunk, self, nullptr);
+            return;
+        }
+        fs::directory_iterator directoryIterator;
+        count(stats.dirOpens);
+        try {
+            directoryIterator = fs::directory_iterator(chunk.path);
+        }catch(const fs::filesystem_error& err) {
+            countError(stats, "directory_iterator", chunk.path, err.what());
+            chunk.failed = true;
+            return;
+        }
+        for(const fs::directory_entry& entry : directoryIterator) {
+            bool isDirectory = entry.is_directory();
+            if(filter && skipped(filter, chunk.path.native(), entry.path().filename().native(), isDirectory, stats)) continue;
+            if(isDirectory) {
+                addSubdir(chunk, fs::path(entry.path()), self,
+                          previousChild(chunk.cached, entry.path().filename().native()), nullptr);
+            }else {
+                unsigned long long fileSize = 0ull;
+                count(stats.stats);
+                try {
+                    fileSize = static_cast<unsigned long long>(entry.file_size());
+                }catch(const fs::filesystem_error& err) {
+                    countError(stats, "file_size", entry.path(), err.what());
+                }
+                chunk.addFile(entry.path().filename().native(), fileSize);
+                addToGroups(groups, self, entry, fileSize, stats);
+            }
+        }
+    }
+
+#ifdef __linux__
+    static inline atomic<bool> haveStatx{true};
+
+    // Size of `name` inside dirFd, following symlinks like fs::directory_entry::file_size.
+    // With needType the entry type is unknown (DT_LNK/DT_UNKNOWN) and isDirectory is filled in.
+    // A stamp (for FileGroups) is filled in by the same call.
+    static error_code nativeStat(int dirFd, const char* name, bool needType,
+                                 bool& isDirectory, unsigned long long& size, FileStamp* stamp, ScanStats& stats) {
+        count(stats.stats);
+        mode_t mode;
+        if(haveStatx.load(memory_order_relaxed)) {
+            struct statx st{};
+            unsigned int mask = needType ? STATX_TYPE | STATX_SIZE : STATX_SIZE;
+            if(stamp) mask |= STATX_UID | STATX_MTIME;
+            if(statx(dirFd, name, needType ? 0 : AT_SYMLINK_NOFOLLOW, mask, &st) == 0) {
+                mode = st.stx_mode;
+                size = st.stx_size;
+                if(stamp) {
+                    if(st.stx_mask & STATX_UID) stamp->owner = st.stx_uid;
+                    if(st.stx_mask & STATX_MTIME) stamp->mtime = st.stx_mtime.tv_sec * 1'000'000'000ll + st.stx_mtime.tv_nsec;
+                }
+            }else if(errno == ENOSYS) {
+                haveStatx.store(false, memory_order_relaxed);
+                return nativeStat(dirFd, name, needType, isDirectory, size, stamp, stats);
+            }else {
+                return {errno, system_category()};
+            }
+        }else {
+            struct stat st{};
+            if(fstatat(dirFd, name, &st, needType ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+                return {errno, system_category()};
+            }
+            mode = st.st_mode;
+            size = static_cast<unsigned long long>(st.st_size);
+            if(stamp) {
+                stamp->owner = st.st_uid;
+                stamp->mtime = st.st_mtim.tv_sec * 1'000'000'000ll + st.st_mtim.tv_nsec;
+            }
+        }
+        isDirectory = needType && S_ISDIR(mode);
+        if(needType && !isDirectory && !S_ISREG(mode)) {
+            size = 0;
+            return make_error_code(errc::not_supported);
+        }
+        return {};
+    }
+
+    static void nativeDirStamp(int fd, long long& mtime, unsigned long long& inode, ScanStats& stats) {
+        count(stats.stats);
+        if(haveStatx.load(memory_order_relaxed)) {
+            struct statx st{};
+            if(statx(fd, "", AT_EMPTY_PATH, STATX_MTIME | STATX_INO, &st) == 0) {
+                mtime = st.stx_mtime.tv_sec * 1'000'000'000ll + st.stx_mtime.tv_nsec;
+                inode = st.stx_ino;
+                return;
+            }
+            if(errno != ENOSYS) return;
+            haveStatx.store(false, memory_order_relaxed);
+        }
+        struct stat st{};
+        if(fstat(fd, &st) == 0) {
+            mtime = st.st_mtim.tv_sec * 1'000'000'000ll + st.st_mtim.tv_nsec;
+            inode = st.st_ino;
+        }
+    }
+
+    // Lists chunk with large getdents64 batches. d_type avoids a stat for directories and
+    // special files (unless groups need their owner or age), regular files get one statx
+    // relative to the directory fd.
+    // Returns false when the kernel does not support it, chunk is then left untouched.
+    bool listNative(DirChunk& chunk, size_t self) {
+        constexpr int DIR_FLAGS = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        count(stats.dirOpens);
+        int fd = chunk.parentFd ? openat(chunk.parentFd->fd, chunk.path.filename().c_str(), DIR_FLAGS)
+                                : open(chunk.path.c_str(), DIR_FLAGS);
+        int openError = fd < 0 ? errno : 0; // closing the parent's fd below may change errno
+        chunk.parentFd.reset();
+        // Out of descriptors: the parent's is released above, other workers release theirs as
+        // they finish, so the path is tried again for a while before the directory counts as
+        // failed. If none came free in that time none will, the rest of the scan does not wait.
+        auto outOfDescriptors = [&openError]() { return openError == EMFILE || openError == ENFILE; };
+        if(outOfDescriptors() && !outOfFds.load(memory_order_relaxed)) {
+            for(int attempt = 0; fd < 0 && outOfDescriptors() && attempt < 1000; attempt++) {
+                this_thread::sleep_for(chrono::milliseconds(1));
+                fd = open(chunk.path.c_str(), DIR_FLAGS);
+                openError = fd < 0 ? errno : 0;
+            }
+            if(outOfDescriptors()) outOfFds.store(true, memory_order_relaxed);
+        }
+        if(fd < 0) {
+            error_code ec(openError, system_category());
+            countError(stats, "open", chunk.path, ec.message());
+            chunk.failed = true;
+            return true;
+        }
+        auto dirFd = make_shared<DirFd>(fd, heldDirFds);
+        nativeDirStamp(fd, chunk.mtime, chunk.inode, stats);
+        // what subdirectories open themselves relative to, nothing (the full path) past the limit
+        shared_ptr<DirFd> subdirFd = heldDirFds.load(memory_order_relaxed) <= maxHeldDirFds ? dirFd : nullptr;
+        if(unchanged(chunk)) {
+            reuseCached(chunk, self, subdirFd);
+            return true;
+        }
+
+        static thread_local vector<char> buffer(256 * 1024);
+        while(true) {
+            count(stats.dirReads);
+            long read = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if(read < 0) {
+                if(errno == EINTR) continue;
+                if(errno == ENOSYS && chunk.files.empty() && chunk.subdirs.empty()) return false;
+                error_code ec(errno, system_category());
+                countError(stats, "getdents64", chunk.path, ec.message());
+                break;
+            }
+            if(read == 0) break;
+            for(long offset = 0; offset < read;) {
+                auto* entry = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+                offset += entry->d_reclen;
+                const char* name = entry->d_name;
+                if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+                bool isDirectory = entry->d_type == DT_DIR;
+                // symlinks and unknown types are only filtered once the stat told what they are
+                bool typeKnown = entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN;
+                if(filter && typeKnown && skipped(filter, chunk.path.native(), name, isDirectory, stats)) continue;
+                unsigned long long fileSize = 0ull;
+                FileStamp stamp;
+                FileStamp* wantStamp = groups && groups->needsStamp() ? &stamp : nullptr;
+                error_code ec;
+                if(entry->d_type == DT_REG) {
+                    ec = nativeStat(fd, name, false, isDirectory, fileSize, wantStamp, stats);
+                }else if(entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+                    ec = nativeStat(fd, name, true, isDirectory, fileSize, wantStamp, stats);
+                }else if(!isDirectory) {
+                    // fifo, socket, device: no size, but grouped by owner and age like the portable backend does
+                    if(wantStamp) nativeStat(fd, name, true, isDirectory, fileSize, wantStamp, stats);
+                    ec = make_error_code(errc::not_supported);
+                }
+                if(filter && !typeKnown && skipped(filter, chunk.path.native(), name, isDirectory, stats)) continue;
+                if(isDirectory) {
+                    addSubdir(chunk, chunk.path / name, self, previousChild(chunk.cached, name), subdirFd);
+                    continue;
+                }
+                if(ec) {
+                    countError(stats, "file_size", chunk.path / name, ec.message());
+                }
+                chunk.addFile(name, fileSize);
+                if(groups) groups->add(self, name, fileSize, stamp);
+            }
+        }
+        return true;
+    }
+#endif
+
+    // Directories on another filesystem than the root are left out before they are opened,
+    // including the ones taken over from a previous scan
+    bool onOtherDevice(const DirChunk& chunk) {
+        if(!filter || !filter->sameFileSystem()) return false;
+        count(stats.stats);
+#ifdef __linux__
+        if(chunk.parentFd) {
+            struct stat st{};
+            return fstatat(chunk.parentFd->fd, chunk.path.filename().c_str(), &st, 0) == 0 && filter->otherDevice(st.st_dev);
+        }
+#endif
+        return filter->otherDevice(chunk.path);
+    }
+
+    void scanChunk(DirChunk& chunk, size_t self) {
+        if(onOtherDevice(chunk)) {
+            chunk.parentFd.reset();
+            chunk.skipped = true;
+            count(stats.skipped);
+            return;
+        }
+#ifdef __linux__
+        if(backend == ScanBackend::Native && !listNative(chunk, self)) {
+            backend = ScanBackend::Portable;
+        }
+#endif
+        if(backend == ScanBackend::Portable) {
+            listPortable(chunk, self);
+        }
+        count(stats.files, chunk.files.size());
+        count(stats.dirs);
+    }
+
+    void worker(size_t self) {
+        size_t threads = deques.size();
+        unsigned idleRounds = 0;
+        while(true) {
+            DirChunk* chunk = nullptr;
+            bool found = deques[self].pop(chunk);
+            for(size_t i = 1; !found && i < threads; i++) {
+                found = deques[(self + i) % threads].steal(chunk);
+            }
+            if(found) {
+                idleRounds = 0;
+                scanChunk(*chunk, self);
+                if(pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+                    lock_guard<mutex> guard(doneLock);
+                    done.notify_all();
+                }
+            }else if(pending.load(memory_order_acquire) == 0) {
+                return;
+            }else if(++idleRounds < 64) {
+                this_thread::yield();
+            }else {
+                this_thread::sleep_for(chrono::microseconds(100));
+            }
+        }
+    }
+};
+
+// Adds chunk (and its subdirectories) to the tree in the same order recursiveCalc does
+static uint32_t mergeChunk(ScanTree& tree, DirChunk& chunk, uint32_t name, size_t pathLength, bool isRoot) {
+    if(chunk.failed || chunk.skipped) return NO_DIR;
+    unsigned long long sizeWithFolders = chunk.sizeNoFolders;
+    vector<pair<size_t, size_t>> fileRanges;
+    vector<uint32_t> subdirs;
+    size_t fileIndex = 0, nameStart = 0;
+    auto mergeFiles = [&](size_t filesEnd) {
+        if(fileIndex == filesEnd) return;
+        size_t rangeStart = tree.fileCount();
+        for(; fileIndex < filesEnd; fileIndex++) {
+            auto [nameEnd, size] = chunk.files[fileIndex];
+            PathView fileName(chunk.names.data() + nameStart, nameEnd - nameStart);
+            addFile(tree, fileName, size, tree.childPathLength(pathLength, isRoot, fileName.size()));
+            nameStart = nameEnd;
+        }
+        fileRanges.emplace_back(rangeStart, tree.fileCount());
+    };
+    for(auto& [filesBefore, child] : chunk.subdirs) {
+        mergeFiles(filesBefore);
+        PathString childName = child->path.filename().native();
+        uint32_t subdir = mergeChunk(tree, *child, tree.names.intern(childName),
+                                     tree.childPathLength(pathLength, isRoot, childName.size()), false);
+        child.reset();
+        if(subdir != NO_DIR) {
+            sizeWithFolders += tree.dirFull[subdir];
+            tree.dirFilesBefore[subdir] = static_cast<uint32_t>(filesBefore);
+            subdirs.push_back(subdir);
+        }
+    }
+    mergeFiles(chunk.files.size());
+    PathString().swap(chunk.names);
+    return finishDir(tree, name, sizeWithFolders, chunk.sizeNoFolders, chunk.mtime, chunk.inode, fileRanges, subdirs);
+}
+
+unsigned long long parallelCalc(ScanTree& tree, size_t threads, ScanBackend backend, ScanStats& stats,
+                                const ScanTree* previous, const ScanFilter* filter, FileGroups* groups) {
+    tree.scanStart = unixNanosNow();
+    if(groups) groups->prepare(threads);
+    tree.filterRules = filter ? filter->rules() : string();
+    if(!nativeBackendAvailable()) {
+        backend = ScanBackend::Portable;
+    }
+#ifdef __linux__
+    size_t maxHeldDirFds = SIZE_MAX;
+    if(backend == ScanBackend::Native) {
+        // every directory with unopened subdirectories keeps its fd open, up to half the limit.
+        // The limit is the caller's to raise, the scan only reads it.
+        rlimit limit{};
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            maxHeldDirFds = limit.rlim_cur / 2;
+        }
+    }
+#endif
+    ParallelScan scan(threads, backend, stats, previous, filter, groups);
+#ifdef __linux__
+    scan.maxHeldDirFds = maxHeldDirFds;
+#endif
+    unsigned long long filesBefore = stats.files, dirsBefore = stats.dirs;
+    DirChunk root;
+    root.path = tree.root;
+    if(previous) root.cached = previous->rootDir();
+    scan.pending = 1;
+    scan.deques[0].push(&root);
+
+    vector<thread> workers;
+    workers.reserve(threads);
+    for(size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&ParallelScan::worker, &scan, i);
+    }
+    {
+        unique_lock<mutex> lock(scan.doneLock);
+        scan.done.wait(lock, [&scan] { return scan.pending.load(memory_order_acquire) == 0; });
+    }
+    for(thread& worker : workers) {
+        worker.join();
+    }
+
+    unsigned long long filesFound = stats.files - filesBefore, foldersFound = stats.dirs - dirsBefore;
+    tree.fileParent.reserve(tree.fileCount() + filesFound);
+    tree.fileName.reserve(tree.fileCount() + filesFound);
+    tree.fileSize.reserve(tree.fileCount() + filesFound);
+    tree.dirParent.reserve(tree.dirCount() + foldersFound);
+    tree.dirName.reserve(tree.dirCount() + foldersFound);
+    tree.dirFull.reserve(tree.dirCount() + foldersFound);
+    tree.dirPure.reserve(tree.dirCount() + foldersFound);
+    tree.dirMtime.reserve(tree.dirCount() + foldersFound);
+    tree.dirInode.reserve(tree.dirCount() + foldersFound);
+    tree.dirFilesBefore.reserve(tree.dirCount() + foldersFound);
+    const PathString& rootName = tree.root.native();
+    uint32_t rootDir = mergeChunk(tree, root, tree.names.intern(rootName), rootName.size(), true);
+    return rootDir == NO_DIR ? 0 : tree.dirFull[rootDir];
+}
@@ -0,0 +1,71 @@
+#ifndef FILESIZECALCULATOR_SCAN_H
+#define FILESIZECALCULATOR_SCAN_H
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <stop_token>
+
+#include "messages.h"
+#include "tree.h"
+
+class ScanFilter;
+class FileGroups;
+
+enum class ScanBackend {
+    Portable, // std::filesystem::directory_iterator
+    Native    // getdents64 + statx relative to directory fds (Linux only)
+};
+
+// Whether ScanBackend::Native is compiled in, otherwise parallelCalc falls back to Portable
+bool nativeBackendAvailable();
+
+// Counted while scanning, read from other threads for progress. Counts add up over every scan
+// they are passed to. Directory reads are only known for the native backend (one per
+// getdents64), std::filesystem reads inside its iterator.
+struct ScanStats {
+    std::atomic<unsigned long long> files{0}, dirs{0};
+    std::atomic<unsigned long long> reusedDirs{0}; // taken over from a previous scan
+    std::atomic<unsigned long long> errors{0};
+    std::atomic<unsigned long long> skipped{0}; // entries left out by a ScanFilter
+    std::atomic<unsigned long long> dirOpens{0}, dirReads{0}, stats{0};
+    MessageSink messages; // told about every entry counted in errors, from the scanning threads
+};
+
+// Counts an entry that could not be read in stats.errors and tells stats.messages
+// "err <what> <path>: <why>"
+void countError(ScanStats& stats, const char* what, const std::filesystem::path& path, const std::string& why);
+
+// Serial depth-first scan of tree.root with std::filesystem, returns the total size.
+// Entries the filter skips are left out of the tree and of every size, excluded directories
+// are not opened. Every file that is kept is also counted into groups.
+unsigned long long recursiveCalc(ScanTree& tree, ScanStats& stats, const ScanFilter* filter = nullptr,
+                                 FileGroups* groups = nullptr);
+
+// Multi-threaded recursiveCalc: builds the same tree, directories are scanned on `threads`
+// workers with work stealing. With a previous scan of the same root and filter rules, directories
+// whose mtime and inode are unchanged reuse its entries instead of being listed and stat'ed again
+// (not when groups need owners or ages, the previous scan has none). Each worker counts into
+// its own tables of groups. The native backend keeps directory fds open, at most half of the
+// RLIMIT_NOFILE soft limit, which it leaves as it is.
+unsigned long long parallelCalc(ScanTree& tree, size_t threads, ScanBackend backend, ScanStats& stats,
+                                const ScanTree* previous = nullptr, const ScanFilter* filter = nullptr,
+                                FileGroups* groups = nullptr);
+
+// What streamCalc hands out as soon as it is done with an entry: every file, and every
+// directory once everything below it was visited (directories come after their contents).
+// Either may be left empty. Paths are only valid during the call.
+struct ScanCallbacks {
+    std::function<void(const std::filesystem::path& path, unsigned long long size)> file;
+    std::function<void(const std::filesystem::path& path, unsigned long long sizeWithFolders,
+                       unsigned long long sizeNoFolders)> dir;
+};
+
+// recursiveCalc without a tree: nothing is kept, memory only grows with the depth of the
+// tree. Returns the total size. Once a stop is requested the scan returns after the current
+// entry: the directories it was in get no callback, and it returns 0.
+unsigned long long streamCalc(const std::filesystem::path& root, const ScanCallbacks& callbacks, ScanStats& stats,
+                              const ScanFilter* filter = nullptr, FileGroups* groups = nullptr,
+                              std::stop_token stop = {});
+
+#endif //FILESIZECALCULATOR_SCAN_H
@@ -0,0 +1,35 @@
+#include "scanner.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+AsyncScan::AsyncScan(fs::path root, ScanCallbacks callbacks, const ScanFilter* filter, FileGroups* groups,
+                     MessageSink messages)
+    : worker([this, root = std::move(root), callbacks = std::move(callbacks), filter, groups,
+              messages = std::move(messages)](stop_token stop) mutable {
+          scanStats.messages = std::move(messages);
+          total = streamCalc(root, callbacks, scanStats, filter, groups, stop);
+          finished.store(true, memory_order_release);
+      }) {}
+
+AsyncScan::~AsyncScan() {
+    cancel();
+    wait();
+}
+
+void AsyncScan::cancel() {
+    worker.request_stop();
+}
+
+bool AsyncScan::cancelled() const {
+    return worker.get_stop_token().stop_requested();
+}
+
+bool AsyncScan::done() const {
+    return finished.load(memory_order_acquire);
+}
+
+unsigned long long AsyncScan::wait() {
+    if(worker.joinable()) worker.join();
+    return total;
+}
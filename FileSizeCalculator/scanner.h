@@ -0,0 +1,46 @@
+#ifndef FILESIZECALCULATOR_SCANNER_H
+#define FILESIZECALCULATOR_SCANNER_H
+
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+#include "scan.h"
+
+// streamCalc on a thread of its own, for programs that keep doing other work while a folder
+// is scanned. The callbacks run on that thread, with the same paths and sizes streamCalc
+// hands out, nothing is collected in between. The filter (and groups) must outlive the scan.
+// Entries that cannot be read are sent to messages, from the same thread.
+//
+//     AsyncScan scan(root, {nullptr, [&](const fs::path& dir, auto full, auto pure) { ... }});
+//     ...
+//     if(shuttingDown) scan.cancel();
+//     unsigned long long total = scan.wait();
+class AsyncScan {
+public:
+    AsyncScan(std::filesystem::path root, ScanCallbacks callbacks, const ScanFilter* filter = nullptr,
+              FileGroups* groups = nullptr, MessageSink messages = {});
+    // Cancels the scan if it still runs and waits for it
+    ~AsyncScan();
+    AsyncScan(const AsyncScan&) = delete;
+    AsyncScan& operator=(const AsyncScan&) = delete;
+
+    // Asks the scan to stop after the entry it is at, without waiting for it
+    void cancel();
+    bool cancelled() const;
+    // Whether the scan returned, wait() does not block then
+    bool done() const;
+    // Waits for the scan, returns the total size (0 if it was cancelled)
+    unsigned long long wait();
+
+    // Updated while the scan runs, like the ScanStats of the other scans
+    const ScanStats& stats() const { return scanStats; }
+
+private:
+    ScanStats scanStats;
+    std::atomic<bool> finished{false};
+    unsigned long long total = 0;
+    std::jthread worker; // last, so that it starts after everything it uses and stops first
+};
+
+#endif //FILESIZECALCULATOR_SCANNER_H
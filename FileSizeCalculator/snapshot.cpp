@@ -0,0 +1,174 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+#include "output.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr char SNAPSHOT_MAGIC[8] = {'F', 'S', 'C', 'S', 'N', 'A', 'P', '\0'};
+static constexpr uint32_t SNAPSHOT_VERSION = 3;
+static constexpr uint64_t BYTE_ORDER_MARK = 0x0102030405060708ull;
+
+// Followed by the root path, the filter rules, every name's length, the names back to back, the directory
+// columns and the file columns
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pathCharSize;
+    uint64_t byteOrder;
+    int64_t scanStart;
+    uint64_t longestPathName;
+    uint64_t rootLength;
+    uint64_t filterLength;
+    uint64_t nameCount;
+    uint64_t nameChars;
+    uint64_t dirCount;
+    uint64_t fileCount;
+};
+
+template<typename T>
+static void writeArray(ostream& out, const T* data, size_t count) {
+    out.write(reinterpret_cast<const char*>(data), static_cast<streamsize>(count * sizeof(T)));
+}
+
+template<typename T>
+static void writeColumn(ostream& out, const vector<T>& column) {
+    writeArray(out, column.data(), column.size());
+}
+
+template<typename T>
+static bool readColumn(istream& in, vector<T>& column, size_t count) {
+    column.resize(count);
+    in.read(reinterpret_cast<char*>(column.data()), static_cast<streamsize>(count * sizeof(T)));
+    return static_cast<bool>(in);
+}
+
+bool saveSnapshot(const ScanTree& tree, const fs::path& path) {
+    const PathString& root = tree.root.native();
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.pathCharSize = sizeof(PathChar);
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.scanStart = tree.scanStart;
+    header.longestPathName = tree.longestPathName;
+    header.rootLength = root.size();
+    header.filterLength = tree.filterRules.size();
+    header.nameCount = tree.names.size();
+    vector<uint32_t> nameLengths(tree.names.size());
+    for(uint32_t id = 0; id < tree.names.size(); id++) {
+        nameLengths[id] = static_cast<uint32_t>(tree.names[id].size());
+        header.nameChars += nameLengths[id];
+    }
+    header.dirCount = tree.dirCount();
+    header.fileCount = tree.fileCount();
+
+    return writeFileAtomically(path, [&](ostream& out) {
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeArray(out, root.data(), root.size());
+        writeArray(out, tree.filterRules.data(), tree.filterRules.size());
+        writeColumn(out, nameLengths);
+        // names are gathered into large blocks, the stream is unbuffered
+        PathString block;
+        for(uint32_t id = 0; id < tree.names.size(); id++) {
+            block += tree.names[id];
+            if(block.size() >= (1 << 20)) {
+                writeArray(out, block.data(), block.size());
+                block.clear();
+            }
+        }
+        writeArray(out, block.data(), block.size());
+        writeColumn(out, tree.dirParent);
+        writeColumn(out, tree.dirName);
+        writeColumn(out, tree.dirFull);
+        writeColumn(out, tree.dirPure);
+        writeColumn(out, tree.dirMtime);
+        writeColumn(out, tree.dirInode);
+        writeColumn(out, tree.dirFilesBefore);
+        writeColumn(out, tree.fileParent);
+        writeColumn(out, tree.fileName);
+        writeColumn(out, tree.fileSize);
+    }, ios::binary);
+}
+
+// Every index must point at an existing entry and parents come after their children,
+// otherwise building paths or reusing entries could run off the columns
+static bool validSnapshot(const ScanTree& tree) {
+    size_t dirs = tree.dirCount(), names = tree.names.size();
+    for(size_t dir = 0; dir < dirs; dir++) {
+        uint32_t parent = tree.dirParent[dir];
+        if(parent == NO_DIR ? dir + 1 != dirs : parent <= dir || parent >= dirs) return false;
+        if(tree.dirName[dir] >= names) return false;
+    }
+    for(size_t file = 0; file < tree.fileCount(); file++) {
+        if(tree.fileParent[file] >= dirs || tree.fileName[file] >= names) return false;
+    }
+    return true;
+}
+
+unique_ptr<ScanTree> loadSnapshot(const fs::path& path) {
+    auto fail = [&path](const string& why) {
+        cerr << "Error failed to load snapshot '" << path.string() << "': " << why << endl;
+        return nullptr;
+    };
+    error_code ec;
+    uintmax_t fileSize = fs::file_size(path, ec);
+    if(ec) return fail(ec.message());
+    ifstream in(path, ios::binary);
+    if(!in) return fail("cannot open");
+
+    SnapshotHeader header{};
+    if(!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        return fail("not a snapshot");
+    }
+    if(header.version != SNAPSHOT_VERSION || header.pathCharSize != sizeof(PathChar) || header.byteOrder != BYTE_ORDER_MARK) {
+        return fail("written by another version or platform");
+    }
+    // the counts decide how much is allocated, check them against the file before trusting them
+    uint64_t counts[] = {header.rootLength, header.filterLength, header.nameCount, header.nameChars, header.dirCount, header.fileCount};
+    for(uint64_t count : counts) {
+        if(count > fileSize) return fail("corrupt header");
+    }
+    uint64_t expected = sizeof(header) + (header.rootLength + header.nameChars) * sizeof(PathChar) + header.filterLength
+                        + header.nameCount * sizeof(uint32_t)
+                        + header.dirCount * (3 * sizeof(uint32_t) + 4 * sizeof(uint64_t))
+                        + header.fileCount * (2 * sizeof(uint32_t) + sizeof(uint64_t));
+    if(expected != fileSize || header.dirCount >= NO_DIR || header.nameCount >= NO_NAME) {
+        return fail("truncated or corrupt");
+    }
+
+    PathString root(header.rootLength, PathChar());
+    in.read(reinterpret_cast<char*>(root.data()), static_cast<streamsize>(root.size() * sizeof(PathChar)));
+    auto tree = make_unique<ScanTree>(fs::path(std::move(root)));
+    tree->filterRules.resize(header.filterLength);
+    in.read(tree->filterRules.data(), static_cast<streamsize>(tree->filterRules.size()));
+    tree->scanStart = header.scanStart;
+    tree->longestPathName = header.longestPathName;
+
+    vector<uint32_t> nameLengths;
+    PathString nameChars(header.nameChars, PathChar());
+    readColumn(in, nameLengths, header.nameCount);
+    in.read(reinterpret_cast<char*>(nameChars.data()), static_cast<streamsize>(nameChars.size() * sizeof(PathChar)));
+    size_t nameStart = 0;
+    for(uint32_t id = 0; id < header.nameCount; id++) {
+        if(nameLengths[id] > nameChars.size() - nameStart) return fail("corrupt names");
+        // names are unique, so interning them in order gives back the same ids
+        if(tree->names.intern(PathView(nameChars.data() + nameStart, nameLengths[id])) != id) return fail("corrupt names");
+        nameStart += nameLengths[id];
+    }
+
+    bool read = readColumn(in, tree->dirParent, header.dirCount) && readColumn(in, tree->dirName, header.dirCount)
+                && readColumn(in, tree->dirFull, header.dirCount) && readColumn(in, tree->dirPure, header.dirCount)
+                && readColumn(in, tree->dirMtime, header.dirCount) && readColumn(in, tree->dirInode, header.dirCount)
+                && readColumn(in, tree->dirFilesBefore, header.dirCount)
+                && readColumn(in, tree->fileParent, header.fileCount) && readColumn(in, tree->fileName, header.fileCount)
+                && readColumn(in, tree->fileSize, header.fileCount);
+    if(!read) return fail("truncated");
+    if(!validSnapshot(*tree)) return fail("corrupt tree");
+    return tree;
+}
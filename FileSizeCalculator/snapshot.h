@@ -0,0 +1,18 @@
+#ifndef FILESIZECALCULATOR_SNAPSHOT_H
+#define FILESIZECALCULATOR_SNAPSHOT_H
+
+#include <filesystem>
+#include <memory>
+
+#include "tree.h"
+
+// Binary snapshot of a ScanTree, the columns are stored as they are in memory so saving and
+// loading are a handful of large writes/reads. A snapshot is only meant to be read back on
+// the machine (byte order, path encoding) that wrote it.
+// Returns false (after printing why) if it could not be written.
+bool saveSnapshot(const ScanTree& tree, const std::filesystem::path& path);
+
+// nullptr (after printing why) if the file is not a readable snapshot
+std::unique_ptr<ScanTree> loadSnapshot(const std::filesystem::path& path);
+
+#endif //FILESIZECALCULATOR_SNAPSHOT_H
@@ -0,0 +1,79 @@
+#include "stream.h"
+
+#include <cstdio>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+StreamWriter::StreamWriter(ostream& out, StreamFormat format, unsigned long long minSize)
+        : stream(out), out(out, 64 * 1024), format(format), minSize(minSize) {
+    if(format == StreamFormat::Csv) {
+        this->out << "type,path,size,pure";
+        this->out.endLine();
+        unflushed = true;
+    }
+    flusher = thread([this] {
+        unique_lock<mutex> guard(lock);
+        while(!wake.wait_for(guard, chrono::milliseconds(200), [this] { return stopping; })) {
+            if(unflushed) flushLocked();
+        }
+    });
+}
+
+StreamWriter::~StreamWriter() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    flusher.join();
+}
+
+// JSON string or CSV field, quotes included. Names that are not valid UTF-8 are passed through as is.
+void StreamWriter::quote(const fs::path& path) {
+    string text = path.string();
+    quoted.clear();
+    quoted += '"';
+    for(char c : text) {
+        if(format == StreamFormat::Csv) {
+            if(c == '"') quoted += '"';
+            quoted += c;
+        }else if(c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        }else if(static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            quoted += escaped;
+        }else {
+            quoted += c;
+        }
+    }
+    quoted += '"';
+}
+
+void StreamWriter::file(const fs::path& path, unsigned long long size) {
+    if(size < minSize) return;
+    quote(path);
+    lock_guard<mutex> guard(lock);
+    if(format == StreamFormat::Csv) {
+        out << "file," << quoted << ',' << size << ',';
+    }else {
+        out << R"({"type":"file","path":)" << quoted << R"(,"size":)" << size << '}';
+    }
+    out.endLine();
+    unflushed = true;
+}
+
+void StreamWriter::dir(const fs::path& path, unsigned long long sizeWithFolders, unsigned long long sizeNoFolders) {
+    if(sizeWithFolders < minSize) return;
+    quote(path);
+    lock_guard<mutex> guard(lock);
+    if(format == StreamFormat::Csv) {
+        out << "dir," << quoted << ',' << sizeWithFolders << ',' << sizeNoFolders;
+    }else {
+        out << R"({"type":"dir","path":)" << quoted << R"(,"size":)" << sizeWithFolders << R"(,"pure":)" << sizeNoFolders << '}';
+    }
+    out.endLine();
+    unflushed = true;
+}
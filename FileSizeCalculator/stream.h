@@ -0,0 +1,55 @@
+#ifndef FILESIZECALCULATOR_STREAM_H
+#define FILESIZECALCULATOR_STREAM_H
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "format.h"
+
+enum class StreamFormat {
+    Ndjson, // {"type":"file","path":"...","size":N} / {"type":"dir","path":"...","size":N,"pure":N}
+    Csv     // type,path,size,pure with the path always quoted
+};
+
+// Writes streamCalc's entries as they come. Rows are handed to the stream in small blocks, and
+// a thread of its own hands over what is left every 200 ms, so a reader sees every row soon
+// after it was written, also while the scan waits on a slow directory. Entries smaller than
+// minSize are skipped.
+class StreamWriter {
+    std::ostream& stream;
+    ReportWriter out;
+    StreamFormat format;
+    unsigned long long minSize;
+    std::string quoted;
+    std::mutex lock; // out and stream, shared with the flusher
+    std::condition_variable wake;
+    bool unflushed = false; // rows since the last flush
+    bool stopping = false;
+    std::thread flusher;
+public:
+    StreamWriter(std::ostream& out, StreamFormat format, unsigned long long minSize);
+    ~StreamWriter();
+    StreamWriter(const StreamWriter&) = delete;
+    StreamWriter& operator=(const StreamWriter&) = delete;
+
+    void file(const std::filesystem::path& path, unsigned long long size);
+    void dir(const std::filesystem::path& path, unsigned long long sizeWithFolders, unsigned long long sizeNoFolders);
+    void flush() {
+        std::lock_guard<std::mutex> guard(lock);
+        flushLocked();
+    }
+
+private:
+    void quote(const std::filesystem::path& path);
+    void flushLocked() {
+        out.flush();
+        stream.flush();
+        unflushed = false;
+    }
+};
+
+#endif //FILESIZECALCULATOR_STREAM_H
@@ -0,0 +1,140 @@
+#include "tree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+uint32_t NamePool::intern(PathView name) {
+    auto found = ids.find(name);
+    if(found != ids.end()) return found->second;
+    if(blockFree < name.size()) {
+        // names longer than a block get a block of their own
+        size_t capacity = max(BLOCK_SIZE, name.size());
+        blocks.push_back(make_unique<PathChar[]>(capacity));
+        blockNext = blocks.back().get();
+        blockFree = capacity;
+    }
+    PathChar* stored = blockNext;
+    copy(name.begin(), name.end(), stored);
+    blockNext += name.size();
+    blockFree -= name.size();
+    PathView view(stored, name.size());
+    uint32_t id = static_cast<uint32_t>(views.size());
+    views.push_back(view);
+    ids.emplace(view, id);
+    return id;
+}
+
+uint32_t NamePool::find(PathView name) const {
+    auto found = ids.find(name);
+    return found == ids.end() ? NO_NAME : found->second;
+}
+
+// Same rule fs::path::operator/ uses: "dir" / "a" -> "dir/a", but "dir/" / "a" and "C:" / "a" add nothing
+ScanTree::ScanTree(fs::path root) : root(std::move(root)) {
+    rootNeedsSeparator = this->root.has_filename();
+}
+
+size_t ScanTree::childPathLength(size_t parentLength, bool parentIsRoot, size_t nameLength) const {
+    return parentLength + (parentIsRoot && !rootNeedsSeparator ? 0 : 1) + nameLength;
+}
+
+void ScanTree::appendDirPath(uint32_t dir, PathString& out) const {
+    static thread_local vector<uint32_t> chain;
+    chain.clear();
+    for(uint32_t current = dir; current != NO_DIR; current = dirParent[current]) {
+        chain.push_back(current);
+    }
+    for(size_t i = chain.size(); i-- > 0;) {
+        if(i + 1 < chain.size() && (i + 2 < chain.size() || rootNeedsSeparator)) {
+            out += fs::path::preferred_separator;
+        }
+        out += names[dirName[chain[i]]];
+    }
+}
+
+void ScanTree::appendChildPath(uint32_t dir, PathView name, PathString& out) const {
+    appendDirPath(dir, out);
+    if(dirParent[dir] != NO_DIR || rootNeedsSeparator) {
+        out += fs::path::preferred_separator;
+    }
+    out += name;
+}
+
+void ScanTree::appendFilePath(uint32_t file, PathString& out) const {
+    appendChildPath(fileParent[file], names[fileName[file]], out);
+}
+
+template<typename Path>
+static string narrow(const Path& path) {
+    if constexpr(is_same_v<Path, string>) {
+        return path;
+    }else {
+        return fs::path(path).string();
+    }
+}
+
+string ScanTree::dirPath(uint32_t dir) const {
+    PathString out;
+    appendDirPath(dir, out);
+    return narrow(out);
+}
+
+string ScanTree::filePath(uint32_t file) const {
+    PathString out;
+    appendFilePath(file, out);
+    return narrow(out);
+}
+
+// Files and subdirectories of a directory each stay in index order, which is listing order.
+// dirFilesBefore says where each subdirectory goes between the files.
+TreeChildren::TreeChildren(const ScanTree& tree) {
+    size_t dirs = tree.dirCount(), files = tree.fileCount();
+    vector<size_t> fileStart(dirs + 1, 0), dirStart(dirs + 1, 0);
+    for(size_t file = 0; file < files; file++) {
+        fileStart[tree.fileParent[file] + 1]++;
+    }
+    for(size_t dir = 0; dir < dirs; dir++) {
+        if(tree.dirParent[dir] != NO_DIR) dirStart[tree.dirParent[dir] + 1]++;
+    }
+    for(size_t dir = 0; dir < dirs; dir++) {
+        fileStart[dir + 1] += fileStart[dir];
+        dirStart[dir + 1] += dirStart[dir];
+    }
+    // group files and subdirectories by parent, both stay in index order
+    vector<uint32_t> filesOf(files), dirsOf(dirStart[dirs]);
+    {
+        vector<size_t> next(fileStart.begin(), fileStart.end() - 1);
+        for(size_t file = 0; file < files; file++) {
+            filesOf[next[tree.fileParent[file]]++] = static_cast<uint32_t>(file);
+        }
+        next.assign(dirStart.begin(), dirStart.end() - 1);
+        for(size_t dir = 0; dir < dirs; dir++) {
+            if(tree.dirParent[dir] != NO_DIR) dirsOf[next[tree.dirParent[dir]]++] = static_cast<uint32_t>(dir);
+        }
+    }
+    start.resize(dirs + 1);
+    entries.reserve(files + dirsOf.size());
+    for(size_t dir = 0; dir < dirs; dir++) {
+        start[dir] = entries.size();
+        size_t file = fileStart[dir];
+        for(size_t sub = dirStart[dir]; sub < dirStart[dir + 1]; sub++) {
+            uint32_t subdir = dirsOf[sub];
+            while(file < fileStart[dir + 1] && file - fileStart[dir] < tree.dirFilesBefore[subdir]) {
+                entries.push_back(filesOf[file++]);
+            }
+            entries.push_back(subdir | DIR_ENTRY);
+        }
+        while(file < fileStart[dir + 1]) {
+            entries.push_back(filesOf[file++]);
+        }
+    }
+    start[dirs] = entries.size();
+}
+
+long long unixNanosNow() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,89 @@
+#ifndef FILESIZECALCULATOR_TREE_H
+#define FILESIZECALCULATOR_TREE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using PathChar = std::filesystem::path::value_type;
+using PathString = std::filesystem::path::string_type;
+using PathView = std::basic_string_view<PathChar>;
+
+constexpr uint32_t NO_DIR = UINT32_MAX;
+constexpr uint32_t NO_NAME = UINT32_MAX;
+
+// Interned path components. Every distinct name is stored once in fixed size blocks
+// that never move, so the views handed out stay valid for the lifetime of the pool.
+class NamePool {
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+    std::vector<std::unique_ptr<PathChar[]>> blocks;
+    PathChar* blockNext = nullptr;
+    size_t blockFree = 0;
+    std::vector<PathView> views;
+    std::unordered_map<PathView, uint32_t> ids;
+public:
+    uint32_t intern(PathView name);
+    uint32_t find(PathView name) const; // NO_NAME if it was never interned
+    PathView operator[](uint32_t id) const { return views[id]; }
+    size_t size() const { return views.size(); }
+};
+
+// Result of a scan as struct-of-arrays. Directories are numbered in post-order (children
+// before their parent, the root is last), files in the order they were listed, which is
+// the order recursiveCalc used to emit them. Full paths only exist when asked for.
+struct ScanTree {
+    std::filesystem::path root;
+    NamePool names;
+
+    std::vector<uint32_t> dirParent; // NO_DIR for the root
+    std::vector<uint32_t> dirName;   // the root's name is its whole path
+    std::vector<unsigned long long> dirFull, dirPure;
+    std::vector<long long> dirMtime;            // nanoseconds since the unix epoch, 0 if unknown
+    std::vector<unsigned long long> dirInode;   // 0 if unknown (portable backend)
+    std::vector<uint32_t> dirFilesBefore;       // files of the parent listed before this directory
+
+    std::vector<uint32_t> fileParent;
+    std::vector<uint32_t> fileName;
+    std::vector<unsigned long long> fileSize;
+
+    size_t longestPathName = 0; // longest file path, in characters
+    long long scanStart = 0;    // nanoseconds since the unix epoch when the scan began
+    std::string filterRules;    // ScanFilter::rules() of the scan, empty if nothing was left out
+
+    explicit ScanTree(std::filesystem::path root);
+
+    size_t dirCount() const { return dirFull.size(); }
+    size_t fileCount() const { return fileSize.size(); }
+    uint32_t rootDir() const { return dirCount() == 0 ? NO_DIR : static_cast<uint32_t>(dirCount() - 1); }
+
+    // Length of the path of a child named `name` inside a directory whose path has parentLength characters
+    size_t childPathLength(size_t parentLength, bool parentIsRoot, size_t nameLength) const;
+
+    void appendDirPath(uint32_t dir, PathString& out) const;
+    void appendFilePath(uint32_t file, PathString& out) const;
+    void appendChildPath(uint32_t dir, PathView name, PathString& out) const; // entry `name` inside dir
+    std::string dirPath(uint32_t dir) const;
+    std::string filePath(uint32_t file) const;
+
+private:
+    bool rootNeedsSeparator;
+};
+
+// Entries of every directory in the order the directory listed them (files and subdirectories
+// interleaved), rebuilt from the parent columns and dirFilesBefore. Subdirectories have DIR_ENTRY set.
+struct TreeChildren {
+    static constexpr uint32_t DIR_ENTRY = 0x80000000u;
+    std::vector<size_t> start; // entries of dir d are entries[start[d]] .. entries[start[d + 1] - 1]
+    std::vector<uint32_t> entries;
+
+    explicit TreeChildren(const ScanTree& tree);
+};
+
+// Current time in the unit of ScanTree::dirMtime
+long long unixNanosNow();
+
+#endif //FILESIZECALCULATOR_TREE_H
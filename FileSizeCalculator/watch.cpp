@@ -0,0 +1,537 @@
+#include "watch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <system_error>
+
+#ifdef __linux__
+#include <csignal>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+TreeWatcher::TreeWatcher(ScanTree& tree, size_t threads, ScanBackend backend, const ScanFilter* filter,
+                         MessageSink messages)
+        : tree(tree), threads(threads), backend(backend), filter(filter), messages(std::move(messages)) {}
+
+#ifdef __linux__
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+    stopRequested = 1;
+}
+
+// IN_MODIFY covers writes, truncation and fallocate. Directories reached through a symlink are
+// watched like the scan lists them, through the link.
+static constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO
+                                       | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+TreeWatcher::~TreeWatcher() {
+    if(inotifyFd >= 0) close(inotifyFd);
+}
+
+void TreeWatcher::indexTree() {
+    root = tree.rootDir();
+    files.clear();
+    dirs.clear();
+    freeDirs.clear();
+    files.reserve(tree.fileCount());
+    dirs.reserve(tree.dirCount());
+    entryCount.assign(tree.dirCount(), 0);
+    for(uint32_t file = 0; file < tree.fileCount(); file++) {
+        files.emplace(entryKey(tree.fileParent[file], tree.fileName[file]), file);
+        entryCount[tree.fileParent[file]]++;
+    }
+    for(uint32_t dir = 0; dir < tree.dirCount(); dir++) {
+        uint32_t parent = tree.dirParent[dir];
+        if(parent == NO_DIR) continue;
+        dirs.emplace(entryKey(parent, tree.dirName[dir]), dir);
+        entryCount[parent]++;
+    }
+}
+
+bool TreeWatcher::start() {
+    if(tree.dirCount() == 0) {
+        cerr << "\nError nothing to watch, the folder could not be scanned" << endl;
+        return false;
+    }
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotifyFd < 0) {
+        cerr << "\nError inotify_init1: " << error_code(errno, system_category()).message() << endl;
+        return false;
+    }
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+
+    indexTree();
+    watchOfDir.assign(tree.dirCount(), -1);
+    dirOfWatch.clear();
+    dirOfWatch.reserve(tree.dirCount());
+    sendMessage(messages, MessageLevel::Progress, "Adding watches...");
+    PathString path;
+    for(uint32_t dir = 0; dir < tree.dirCount(); dir++) {
+        path.clear();
+        tree.appendDirPath(dir, path);
+        addWatch(dir, path);
+    }
+    return true;
+}
+
+void TreeWatcher::addWatch(uint32_t dir, const PathString& path) {
+    int wd = inotify_add_watch(inotifyFd, path.c_str(), WATCH_MASK);
+    if(wd < 0) {
+        if(errno == ENOSPC) {
+            if(!watchLimitReached) {
+                sendMessage(messages, MessageLevel::Warning, "Warning inotify watch limit reached "
+                            "(fs.inotify.max_user_watches), changes in some directories are not seen");
+            }
+            watchLimitReached = true;
+        }else if(errno != ENOENT) { // a directory that is already gone is removed by its parent's event
+            error_code ec(errno, system_category());
+            sendMessage(messages, MessageLevel::Error, "err inotify_add_watch '" + path + "': " + ec.message());
+        }
+        return;
+    }
+    // a directory reached twice through symlinks gets the same watch, the first one keeps it
+    if(dirOfWatch.emplace(wd, dir).second) {
+        watchOfDir[dir] = wd;
+    }
+}
+
+void TreeWatcher::removeWatch(uint32_t dir) {
+    int wd = watchOfDir[dir];
+    if(wd < 0) return;
+    inotify_rm_watch(inotifyFd, wd);
+    dirOfWatch.erase(wd);
+    watchOfDir[dir] = -1;
+}
+
+WatchWake TreeWatcher::wait(int timeoutMs) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    vector<uint64_t> touched;
+    while(true) {
+        if(stopRequested || rootGone) return WatchWake::Stop;
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        int ready = poll(fds, watchInput ? 2 : 1, static_cast<int>(max(0ll, static_cast<long long>(left))));
+        if(ready < 0) {
+            if(errno == EINTR) continue;
+            cerr << "\nError poll: " << error_code(errno, system_category()).message() << endl;
+            return WatchWake::Stop;
+        }
+        if(ready == 0) return WatchWake::Timeout;
+        if(fds[0].revents & POLLIN) {
+            touched.clear();
+            readEvents(touched);
+            // a file written in small pieces is stat'ed once per batch
+            sort(touched.begin(), touched.end());
+            touched.erase(unique(touched.begin(), touched.end()), touched.end());
+            for(uint64_t key : touched) {
+                refresh(static_cast<uint32_t>(key >> 32), static_cast<uint32_t>(key));
+            }
+            // removed files are only dropped from the columns here, once they are the majority
+            if(removedFiles > 1024 && removedFiles > tree.fileCount() / 2) compact();
+        }
+        if(watchInput && (fds[1].revents & (POLLIN | POLLHUP))) return WatchWake::Input;
+    }
+}
+
+// Entries named in the events are collected in `touched` and looked at once the queue is
+// drained. Moves are applied right away, both halves arrive next to each other.
+void TreeWatcher::readEvents(vector<uint64_t>& touched) {
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool overflow = false;
+    bool movePending = false;
+    uint32_t moveCookie = 0, moveDir = 0, moveName = 0;
+    while(true) {
+        ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        if(length < 0 && errno == EINTR) continue;
+        if(length <= 0) break;
+        for(ssize_t offset = 0; offset < length;) {
+            auto* event = reinterpret_cast<inotify_event*>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            auto watched = dirOfWatch.find(event->wd);
+            if(watched == dirOfWatch.end()) continue;
+            uint32_t dir = watched->second;
+            if(event->mask & IN_IGNORED) {
+                dirOfWatch.erase(watched);
+                watchOfDir[dir] = -1;
+                continue;
+            }
+            if(event->mask & IN_DELETE_SELF) {
+                if(dir == root) rootGone = true;
+                continue;
+            }
+            if(event->len == 0) continue;
+            uint32_t name = tree.names.intern(event->name);
+            if(movePending) {
+                movePending = false;
+                if((event->mask & IN_MOVED_TO) && event->cookie == moveCookie) {
+                    move(moveDir, moveName, dir, name);
+                    touched.push_back(entryKey(dir, name));
+                    continue;
+                }
+                touched.push_back(entryKey(moveDir, moveName)); // moved out of the tree
+            }
+            if(event->mask & IN_MOVED_FROM) {
+                movePending = true;
+                moveCookie = event->cookie;
+                moveDir = dir;
+                moveName = name;
+                continue;
+            }
+            touched.push_back(entryKey(dir, name));
+        }
+    }
+    if(movePending) touched.push_back(entryKey(moveDir, moveName));
+    if(overflow) {
+        touched.clear();
+        rescan();
+    }
+}
+
+void TreeWatcher::rescan() {
+    sendMessage(messages, MessageLevel::Warning,
+                "Warning too many changes at once, events were lost. Scanning again...");
+    close(inotifyFd);
+    inotifyFd = -1;
+    tree = ScanTree(tree.root);
+    removedFiles = 0;
+    ScanStats stats;
+    stats.messages = messages;
+    parallelCalc(tree, threads, backend, stats, nullptr, filter);
+    if(!start()) rootGone = true;
+    changed = true;
+}
+
+// Brings the entry `name` inside dir in line with what is on disk now
+void TreeWatcher::refresh(uint32_t dir, uint32_t name) {
+    if(dir >= tree.dirCount() || tree.dirParent[dir] == REMOVED_DIR) return;
+    PathString path;
+    tree.appendChildPath(dir, tree.names[name], path);
+    struct stat st{};
+    // like the scan, symlinks are followed and broken ones count as empty files
+    bool exists = stat(path.c_str(), &st) == 0 || lstat(path.c_str(), &st) == 0;
+    if(exists && filter) {
+        // what the filter leaves out is handled like an entry that is not there
+        bool isDirectory = S_ISDIR(st.st_mode);
+        PathString parentPath;
+        tree.appendDirPath(dir, parentPath);
+        exists = !filter->skips(parentPath, tree.names[name], isDirectory) && !(isDirectory && filter->otherDevice(st.st_dev));
+    }
+
+    auto fileFound = files.find(entryKey(dir, name));
+    auto dirFound = dirs.find(entryKey(dir, name));
+    uint32_t file = fileFound == files.end() ? NO_DIR : fileFound->second;
+    uint32_t subdir = dirFound == dirs.end() ? NO_DIR : dirFound->second;
+    if(exists && S_ISDIR(st.st_mode)) {
+        if(file != NO_DIR) removeFile(file);
+        if(subdir == NO_DIR) addDir(dir, name, path);
+        return;
+    }
+    if(subdir != NO_DIR) removeDir(subdir);
+    if(!exists) {
+        if(file != NO_DIR) removeFile(file);
+        return;
+    }
+    unsigned long long size = S_ISREG(st.st_mode) ? static_cast<unsigned long long>(st.st_size) : 0;
+    if(file != NO_DIR) {
+        setFileSize(file, size);
+    }else {
+        addFile(dir, name, size, path.size());
+    }
+}
+
+void TreeWatcher::move(uint32_t fromDir, uint32_t fromName, uint32_t toDir, uint32_t toName) {
+    if(tree.dirParent[fromDir] == REMOVED_DIR || tree.dirParent[toDir] == REMOVED_DIR) return;
+    uint64_t from = entryKey(fromDir, fromName), to = entryKey(toDir, toName);
+    if(from == to || (!files.count(from) && !dirs.count(from))) return; // refresh adds the target
+    // a rename replaces whatever had the target name
+    if(auto replaced = files.find(to); replaced != files.end()) removeFile(replaced->second);
+    if(auto replaced = dirs.find(to); replaced != dirs.end()) removeDir(replaced->second);
+
+    if(auto found = files.find(from); found != files.end()) {
+        uint32_t file = found->second;
+        unsigned long long size = tree.fileSize[file];
+        setFileSize(file, 0);
+        files.erase(found);
+        entryCount[fromDir]--;
+        tree.fileParent[file] = toDir;
+        tree.fileName[file] = toName;
+        files.emplace(to, file);
+        entryCount[toDir]++;
+        setFileSize(file, size);
+        PathString path;
+        tree.appendFilePath(file, path);
+        tree.longestPathName = max(tree.longestPathName, path.size());
+    }else if(auto moved = dirs.find(from); moved != dirs.end()) {
+        uint32_t dir = moved->second;
+        PathString oldPath, newPath;
+        tree.appendDirPath(dir, oldPath);
+        unsigned long long size = tree.dirFull[dir];
+        addToAncestors(fromDir, 0 - size);
+        dirs.erase(moved);
+        entryCount[fromDir]--;
+        tree.dirParent[dir] = toDir;
+        tree.dirName[dir] = toName;
+        dirs.emplace(to, dir);
+        entryCount[toDir]++;
+        addToAncestors(toDir, size);
+        // paths below only grow by what the directory's own path grew, good enough for a column width
+        tree.appendDirPath(dir, newPath);
+        if(newPath.size() > oldPath.size()) tree.longestPathName += newPath.size() - oldPath.size();
+    }
+    changed = true;
+}
+
+void TreeWatcher::addToAncestors(uint32_t dir, unsigned long long delta) {
+    for(uint32_t current = dir; current != NO_DIR; current = tree.dirParent[current]) {
+        tree.dirFull[current] += delta;
+    }
+}
+
+void TreeWatcher::setFileSize(uint32_t file, unsigned long long size) {
+    unsigned long long delta = size - tree.fileSize[file];
+    if(delta == 0) return;
+    uint32_t parent = tree.fileParent[file];
+    tree.fileSize[file] = size;
+    tree.dirPure[parent] += delta;
+    addToAncestors(parent, delta);
+    changed = true;
+}
+
+void TreeWatcher::addFile(uint32_t dir, uint32_t name, unsigned long long size, size_t pathLength) {
+    auto file = static_cast<uint32_t>(tree.fileCount());
+    tree.fileParent.push_back(dir);
+    tree.fileName.push_back(name);
+    tree.fileSize.push_back(0);
+    files.emplace(entryKey(dir, name), file);
+    entryCount[dir]++;
+    tree.longestPathName = max(tree.longestPathName, pathLength);
+    setFileSize(file, size);
+    changed = true;
+}
+
+// The file stays in the columns with size 0 until compact(), the others keep their indices
+void TreeWatcher::removeFile(uint32_t file) {
+    setFileSize(file, 0);
+    uint32_t parent = tree.fileParent[file];
+    files.erase(entryKey(parent, tree.fileName[file]));
+    entryCount[parent]--;
+    tree.fileParent[file] = REMOVED_DIR;
+    removedFiles++;
+    changed = true;
+}
+
+// Adds, watches and lists a directory that appeared. Entries created after the watch was
+// added may be reported again, refresh does not add anything twice.
+void TreeWatcher::addDir(uint32_t parent, uint32_t name, const PathString& path) {
+    uint32_t dir;
+    if(!freeDirs.empty()) {
+        dir = freeDirs.back();
+        freeDirs.pop_back();
+    }else {
+        dir = static_cast<uint32_t>(tree.dirCount());
+        tree.dirParent.push_back(NO_DIR);
+        tree.dirName.push_back(0);
+        tree.dirFull.push_back(0);
+        tree.dirPure.push_back(0);
+        tree.dirMtime.push_back(0);
+        tree.dirInode.push_back(0);
+        tree.dirFilesBefore.push_back(0);
+        entryCount.push_back(0);
+        watchOfDir.push_back(-1);
+    }
+    tree.dirParent[dir] = parent;
+    tree.dirName[dir] = name;
+    tree.dirFull[dir] = tree.dirPure[dir] = 0;
+    tree.dirMtime[dir] = 0; // unknown, an incremental rescan lists it again
+    tree.dirInode[dir] = 0;
+    tree.dirFilesBefore[dir] = UINT32_MAX; // after the files that were listed, the parent is listed again anyway
+    entryCount[dir] = 0;
+    dirs.emplace(entryKey(parent, name), dir);
+    entryCount[parent]++;
+    changed = true;
+
+    addWatch(dir, path);
+    error_code ec;
+    for(fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+        refresh(dir, tree.names.intern(it->path().filename().native()));
+    }
+}
+
+void TreeWatcher::removeDir(uint32_t dir) {
+    vector<uint32_t> removed{dir};
+    if(entryCount[dir] > 0) {
+        // 1 inside the removed subtree, 2 outside, 0 not known yet
+        vector<uint8_t> inside(tree.dirCount(), 0);
+        inside[dir] = 1;
+        vector<uint32_t> chain;
+        for(uint32_t other = 0; other < tree.dirCount(); other++) {
+            uint32_t current = other;
+            while(current != NO_DIR && current != REMOVED_DIR && inside[current] == 0) {
+                chain.push_back(current);
+                current = tree.dirParent[current];
+            }
+            uint8_t state = current == NO_DIR || current == REMOVED_DIR ? 2 : inside[current];
+            for(uint32_t link : chain) inside[link] = state;
+            chain.clear();
+            if(state == 1 && other != dir) removed.push_back(other);
+        }
+        for(size_t file = 0; file < tree.fileCount(); file++) {
+            uint32_t parent = tree.fileParent[file];
+            if(parent != REMOVED_DIR && inside[parent] == 1) removeFile(static_cast<uint32_t>(file));
+        }
+    }
+    // parents are only marked once every key is gone, they are part of the keys
+    for(uint32_t gone : removed) {
+        uint32_t parent = tree.dirParent[gone];
+        dirs.erase(entryKey(parent, tree.dirName[gone]));
+        entryCount[parent]--;
+        removeWatch(gone);
+    }
+    for(uint32_t gone : removed) {
+        tree.dirParent[gone] = REMOVED_DIR;
+        tree.dirFull[gone] = tree.dirPure[gone] = 0;
+        entryCount[gone] = 0;
+        freeDirs.push_back(gone);
+    }
+    changed = true;
+}
+
+void TreeWatcher::compact() {
+    size_t count = tree.dirCount();
+    // subdirectories grouped by parent in index order
+    vector<size_t> childStart(count + 1, 0);
+    for(uint32_t dir = 0; dir < count; dir++) {
+        uint32_t parent = tree.dirParent[dir];
+        if(parent != NO_DIR && parent != REMOVED_DIR) childStart[parent + 1]++;
+    }
+    for(size_t dir = 0; dir < count; dir++) childStart[dir + 1] += childStart[dir];
+    vector<uint32_t> children(childStart[count]);
+    {
+        vector<size_t> next(childStart.begin(), childStart.end() - 1);
+        for(uint32_t dir = 0; dir < count; dir++) {
+            uint32_t parent = tree.dirParent[dir];
+            if(parent != NO_DIR && parent != REMOVED_DIR) children[next[parent]++] = dir;
+        }
+    }
+    // depth-first, every directory is numbered after its subdirectories
+    vector<uint32_t> newIndex(count, NO_DIR);
+    uint32_t numbered = 0;
+    vector<pair<uint32_t, size_t>> stack{{root, childStart[root]}};
+    while(!stack.empty()) {
+        auto [dir, child] = stack.back();
+        if(child < childStart[dir + 1]) {
+            stack.back().second++;
+            stack.emplace_back(children[child], childStart[children[child]]);
+        }else {
+            newIndex[dir] = numbered++;
+            stack.pop_back();
+        }
+    }
+
+    auto permute = [&](auto& column) {
+        remove_reference_t<decltype(column)> moved(numbered);
+        for(size_t dir = 0; dir < count; dir++) {
+            if(newIndex[dir] != NO_DIR) moved[newIndex[dir]] = column[dir];
+        }
+        column.swap(moved);
+    };
+    permute(tree.dirParent);
+    permute(tree.dirName);
+    permute(tree.dirFull);
+    permute(tree.dirPure);
+    permute(tree.dirMtime);
+    permute(tree.dirInode);
+    permute(tree.dirFilesBefore);
+    permute(watchOfDir);
+    for(uint32_t& parent : tree.dirParent) {
+        if(parent != NO_DIR) parent = newIndex[parent];
+    }
+    for(auto& [wd, dir] : dirOfWatch) {
+        dir = newIndex[dir];
+    }
+    root = numbered - 1;
+
+    // files without the removed ones, then in the order a scan lists them: depth-first, each
+    // directory's files and subdirectories interleaved as they were listed
+    size_t kept = 0;
+    for(size_t file = 0; file < tree.fileCount(); file++) {
+        if(tree.fileParent[file] == REMOVED_DIR) continue;
+        tree.fileParent[kept] = newIndex[tree.fileParent[file]];
+        tree.fileName[kept] = tree.fileName[file];
+        tree.fileSize[kept] = tree.fileSize[file];
+        kept++;
+    }
+    tree.fileParent.resize(kept);
+    tree.fileName.resize(kept);
+    tree.fileSize.resize(kept);
+    removedFiles = 0;
+    TreeChildren entries(tree);
+    vector<uint32_t> fileOrder;
+    fileOrder.reserve(kept);
+    vector<pair<uint32_t, size_t>> walk{{root, entries.start[root]}};
+    uint32_t filesListed = 0; // of the directory on top of walk
+    vector<uint32_t> listedAbove;
+    while(!walk.empty()) {
+        auto& [dir, next] = walk.back();
+        if(next == entries.start[dir + 1]) {
+            walk.pop_back();
+            if(!listedAbove.empty()) {
+                filesListed = listedAbove.back();
+                listedAbove.pop_back();
+            }
+            continue;
+        }
+        uint32_t entry = entries.entries[next++];
+        if(entry & TreeChildren::DIR_ENTRY) {
+            uint32_t subdir = entry & ~TreeChildren::DIR_ENTRY;
+            // files of the parent that were removed no longer count
+            tree.dirFilesBefore[subdir] = filesListed;
+            listedAbove.push_back(filesListed);
+            filesListed = 0;
+            walk.emplace_back(subdir, entries.start[subdir]);
+        }else {
+            fileOrder.push_back(entry);
+            filesListed++;
+        }
+    }
+    auto reorder = [&](auto& column) {
+        remove_reference_t<decltype(column)> moved(fileOrder.size());
+        for(size_t file = 0; file < fileOrder.size(); file++) moved[file] = column[fileOrder[file]];
+        column.swap(moved);
+    };
+    reorder(tree.fileParent);
+    reorder(tree.fileName);
+    reorder(tree.fileSize);
+    indexTree();
+}
+
+#else
+
+TreeWatcher::~TreeWatcher() = default;
+
+bool TreeWatcher::start() {
+    cerr << "\nError watching needs inotify, which is only available on Linux" << endl;
+    return false;
+}
+
+WatchWake TreeWatcher::wait(int) {
+    return WatchWake::Stop;
+}
+
+void TreeWatcher::compact() {}
+
+#endif
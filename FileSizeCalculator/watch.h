@@ -0,0 +1,98 @@
+#ifndef FILESIZECALCULATOR_WATCH_H
+#define FILESIZECALCULATOR_WATCH_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "filter.h"
+#include "scan.h"
+#include "tree.h"
+
+enum class WatchWake {
+    Timeout,
+    Input, // stdin has a line to read
+    Stop   // SIGINT/SIGTERM, or the watched folder itself is gone
+};
+
+// Keeps a scanned tree current with inotify (Linux only). Every directory gets a watch and
+// events are applied as they arrive: a file's new size is stat'ed and the difference added to
+// its folder's pure size and to the full size of every ancestor, created entries are added
+// (new directories are listed and watched) and removed ones dropped. Moves within the tree
+// just re-parent the entry.
+// Removed directories stay in the columns with size 0 until their index is reused, removed
+// files stay until the file columns are compacted, so that the remaining files keep their
+// listing order. While watching, directories are therefore not in post-order and rankings
+// have to leave out entries whose parent is REMOVED_DIR (see compact).
+// Changes made between the scan and start() are only seen once the entry changes again.
+// Entries the scan's filter left out stay out when they change or appear. Progress, lost events
+// and directories that cannot be watched are sent to messages.
+class TreeWatcher {
+public:
+    static constexpr uint32_t REMOVED_DIR = NO_DIR - 1; // dirParent / fileParent of a removed entry
+
+    TreeWatcher(ScanTree& tree, size_t threads, ScanBackend backend, const ScanFilter* filter = nullptr,
+                MessageSink messages = {});
+    ~TreeWatcher();
+    TreeWatcher(const TreeWatcher&) = delete;
+    TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+    // Adds a watch to every directory. Returns false (after printing why) without inotify.
+    bool start();
+    // Applies filesystem events until timeoutMs passed, stdin has a line or a stop is requested.
+    // An overflowing event queue means events were lost, the tree is then scanned again.
+    WatchWake wait(int timeoutMs);
+    void ignoreInput() { watchInput = false; } // stdin reached its end
+    bool rootRemoved() const { return rootGone; }
+
+    // Whether anything changed since the last call
+    bool takeChanged() {
+        bool was = changed;
+        changed = false;
+        return was;
+    }
+    unsigned long long totalSize() const { return tree.dirFull[root]; }
+    size_t fileCount() const { return tree.fileCount() - removedFiles; }
+    // Renumbers directories and files without the removed ones as a fresh scan would have
+    // numbered them: directories in post-order, files in listing order with every subtree's
+    // files together (needed before saving a snapshot)
+    void compact();
+
+private:
+    ScanTree& tree;
+    size_t threads;
+    ScanBackend backend;
+    const ScanFilter* filter;
+    MessageSink messages;
+    int inotifyFd = -1;
+    bool watchInput = true;
+    bool changed = false;
+    bool rootGone = false;
+    bool watchLimitReached = false;
+    uint32_t root = NO_DIR;
+    size_t removedFiles = 0;
+    std::unordered_map<uint64_t, uint32_t> files; // (parent << 32 | name) -> file
+    std::unordered_map<uint64_t, uint32_t> dirs;  // (parent << 32 | name) -> directory
+    std::vector<uint32_t> entryCount;             // files and subdirectories in each directory
+    std::vector<int> watchOfDir;                  // -1 without a watch
+    std::unordered_map<int, uint32_t> dirOfWatch;
+    std::vector<uint32_t> freeDirs;
+
+    static uint64_t entryKey(uint32_t dir, uint32_t name) { return static_cast<uint64_t>(dir) << 32 | name; }
+    void indexTree();
+    void addWatch(uint32_t dir, const PathString& path);
+    void removeWatch(uint32_t dir);
+    void readEvents(std::vector<uint64_t>& touched);
+    void rescan();
+
+    void refresh(uint32_t dir, uint32_t name);
+    void move(uint32_t fromDir, uint32_t fromName, uint32_t toDir, uint32_t toName);
+    void addToAncestors(uint32_t dir, unsigned long long delta); // delta wraps around for shrinking
+    void setFileSize(uint32_t file, unsigned long long size);
+    void addFile(uint32_t dir, uint32_t name, unsigned long long size, size_t pathLength);
+    void removeFile(uint32_t file);
+    void addDir(uint32_t parent, uint32_t name, const PathString& path);
+    void removeDir(uint32_t dir);
+};
+
+#endif //FILESIZECALCULATOR_WATCH_H